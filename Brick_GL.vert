@@ -0,0 +1,31 @@
+#version 330 core
+
+// input data : shared brick quad, one record per vertex
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// input data : one record per brick instance, left side and the fall
+// distance of the game when it spawned, both falls taken from the same
+// recent base so they stay small
+layout (location = 2) in vec2 instanceBrick;
+layout (location = 3) in vec3 instanceColor;
+
+uniform mat4 VP;
+uniform float fall; // how far every brick has fallen since that base
+uniform float spawnY;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Every brick falls alike, so its height only depends on how much the
+    // game has fallen since it spawned
+    vec3 offset = vec3(instanceBrick.x, spawnY - (fall - instanceBrick.y), 0);
+    vec4 v = vec4(vertexPosition + offset, 1);
+
+    fragColor = instanceColor;
+
+    // Output position of the vertex, in clip space : VP * (position + offset)
+    gl_Position = VP * v;
+}
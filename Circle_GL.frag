@@ -0,0 +1,23 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec3 fragColor;
+in vec2 local;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    // Signed distance to the rim, negative inside. fwidth is the size of a
+    // pixel in the same units, so the edge fades over one pixel at any zoom
+    // and stays sharp across tilted (elliptical) circles
+    float distance = length(local) - 1.0;
+    float alpha = clamp(0.5 - distance / fwidth(distance), 0.0, 1.0);
+    if (alpha <= 0.0)
+    {
+        discard;
+    }
+
+    color = vec4(fragColor, alpha);
+}
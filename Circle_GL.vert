@@ -0,0 +1,23 @@
+#version 330 core
+
+// input data : square around the circle, one record per vertex
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+uniform mat4 MVP;
+uniform float radius;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+out vec2 local; // position in radii from the centre
+
+void main ()
+{
+    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+
+    fragColor = vertexColor;
+    local = vertexPosition.xy / radius;
+
+    // Output position of the vertex, in clip space : MVP * position
+    gl_Position = MVP * v;
+}
@@ -0,0 +1,33 @@
+#version 330 core
+
+// input data : shared unit beam, one record per vertex
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// input data : one record per laser, where its tail entered the current leg,
+// the leg direction in degrees and the game time it got there
+layout (location = 2) in vec3 instanceLeg;
+layout (location = 3) in float instanceLegTime;
+
+uniform mat4 VP;
+uniform float time; // game time, from the same recent base as instanceLegTime
+uniform float speed; // units per second
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Turn the beam along its leg, then move its tail as far as it has
+    // travelled since entering it
+    float a = radians(instanceLeg.z);
+    vec2 direction = vec2(cos(a), sin(a));
+    vec2 p = mat2(direction.x, direction.y, -direction.y, direction.x) * vertexPosition.xy;
+    vec2 tail = instanceLeg.xy + direction * speed * (time - instanceLegTime);
+    vec4 v = vec4(p + tail, vertexPosition.z, 1);
+
+    fragColor = vertexColor;
+
+    // Output position of the vertex, in clip space : VP * model * position
+    gl_Position = VP * v;
+}
@@ -5,11 +5,12 @@
 #include <string.h>
 #include <cstring>
 #include <string>
-#include <pthread.h>
+#include <map>
+#include <algorithm>
 
 #include <stdlib.h>
-#include <assert.h>
-#include <ao/ao.h>
+#include <time.h>
+#include <chrono>
 
 
 #include <glad/glad.h>
@@ -20,26 +21,16 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-using namespace std;
+#include "audio.h"
+#include "game_core.h"
+#include "game_replay.h"
+#include "game_snapshot.h"
+#include "game_rewind.h"
 
-static const int BUF_SIZE = 4096;
-
-struct WavHeader {
-    char id[4]; //should contain RIFF
-    int32_t totalLength;
-    char wavefmt[8];
-    int32_t format; // 16 for PCM
-    int16_t pcm; // 1 for PCM
-    int16_t channels;
-    int32_t frequency;
-    int32_t bytesPerSecond;
-    int16_t bytesByCapture;
-    int16_t bitsPerSample;
-    char data[4]; // "data"
-    int32_t bytesInData;
-};
+using namespace std;
 
-struct VAO {
+/* GL buffers for one shape, shared by every object with that shape */
+struct Geometry {
     GLuint VertexArrayID;
     GLuint VertexBuffer;
     GLuint ColorBuffer;
@@ -48,14 +39,41 @@ struct VAO {
     GLenum FillMode;
     int NumVertices;
 
-    float x,y,z,inclination,angle; // for mirror
-    bool active,reflection,drag;
-    int brickcount;
-    int color;
+    GLfloat Radius; // > 0 for a circle quad cut out by the circle shader
+};
+
+struct VAO {
+    Geometry* geometry;
 
+    float x,y,z;
 };
 typedef struct VAO VAO;
 
+/* Node of the scene transform hierarchy. A node is placed in its parent by
+   x,y,angle after its fixed "shape" transform. "world" is cached and only
+   rebuilt when the node or one of its ancestors has been moved */
+struct SceneNode {
+    VAO* object; // NULL for a node that only groups its children
+    glm::mat4 shape;
+    float x,y,angle; // angle in degrees
+
+    glm::mat4 world;
+    bool dirty;
+    vector<SceneNode*> children;
+
+    float layer; // z lift, so a node covers the ones created before it where they overlap
+
+    glm::mat4 MVP; // world seen through the camera version below
+    unsigned camera_version; // 0 when world has changed since MVP was built
+};
+
+/* Everything is flat at z=0, so the depth test alone could not tell which of
+   two overlapping shapes is on top once the draw list is sorted. Each node is
+   lifted a step above the previous one instead, in the order the baseline
+   drew them, far less than the tilted basket circles span */
+const float layer_step = 0.001f;
+int layer_count = 0;
+
 struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
@@ -65,6 +83,75 @@ struct GLMatrices {
 
 GLuint programID;
 
+/* View and projection only depend on the visible bounds, so VP is rebuilt when
+   zoom or pan change them and kept otherwise */
+struct CameraCache {
+    float bnx,bx,bny,by;
+    glm::mat4 VP;
+    unsigned version; // bumped on every rebuild, 0 before the first
+} Camera;
+
+/* Bricks and lasers live on the GPU as records that only change when one
+   spawns, turns or goes. Their shaders move them from the fall distance and
+   the game time, so a steady frame uploads nothing but two uniforms */
+struct BrickInstance {
+    GLfloat x,fall; // left side, game fall distance at spawn less BrickRenderer::fall_base
+    GLfloat r,g,b;
+};
+
+struct BrickRenderer {
+    GLuint ProgramID;
+    GLuint VPID;
+    GLuint FallID;
+    GLuint RecordBuffer;
+    unsigned version; // BrickPool::version the records were built from
+    double fall_base; // game fall distance when they were built
+    int count;
+    int capacity; // records RecordBuffer has room for
+    vector<BrickInstance> instances;
+} BrickBatch;
+
+struct LaserInstance {
+    GLfloat x,y,inclination; // tail when it entered its leg, direction in degrees
+    GLfloat legtime; // less LaserRenderer::time_base
+};
+
+struct LaserRenderer {
+    GLuint ProgramID;
+    GLuint VPID;
+    GLuint TimeID;
+    GLuint RecordBuffer;
+    unsigned version; // Game::lasers_version the records were built from
+    double time_base; // game time when they were built
+    int count;
+    int capacity; // records RecordBuffer has room for
+    vector<LaserInstance> instances;
+} LaserBatch;
+
+/* Circles are quads whose fragment shader keeps the pixels inside the
+   radius and fades the edge over one pixel */
+struct CircleRenderer {
+    GLuint ProgramID;
+    GLuint MVPID;
+    GLuint RadiusID;
+} CircleBatch;
+
+/* Upload ring for data that changes between frames. With ARB_buffer_storage
+   the buffer stays mapped and is split into stream_regions regions, each
+   fenced after the frame that wrote to it, so the CPU only waits if the GPU
+   is that many frames behind. Plain GL 3.3 orphans the buffer instead */
+static const int stream_regions = 3;
+
+struct StreamBuffer {
+    GLuint Buffer;
+    int Capacity; // bytes per frame
+    bool Persistent;
+    char* Mapped;
+    int Region; // region written this frame
+    int Used; // bytes written this frame
+    GLsync Fences[stream_regions];
+} DynamicBuffer;
+
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
 
@@ -147,30 +234,251 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
 
+void savereplay ();
+
 void quit(GLFWwindow *window)
 {
+    savereplay();
     glfwDestroyWindow(window);
+    closeaudio();
     glfwTerminate();
 //    exit(EXIT_SUCCESS);
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
+/* Last GL state set through the wrappers below, so setting it again is skipped.
+   calls/skipped count every request since the last --render-stats report */
+struct GLStateCache {
+    GLuint Program;
+    GLuint VertexArray;
+    GLenum FillMode;
+    int Blend; // -1 until first set
+
+    int calls;
+    int skipped;
+    int draws; // draw calls issued
+} GLState = { (GLuint)-1, (GLuint)-1, GL_NONE, -1, 0, 0, 0 };
+
+void useprogram (GLuint program)
+{
+    GLState.calls++;
+    if (GLState.Program == program)
+    {
+        GLState.skipped++;
+        return;
+    }
+    GLState.Program = program;
+    glUseProgram (program);
+}
+
+void bindvertexarray (GLuint vertexarray)
+{
+    GLState.calls++;
+    if (GLState.VertexArray == vertexarray)
+    {
+        GLState.skipped++;
+        return;
+    }
+    GLState.VertexArray = vertexarray;
+    glBindVertexArray (vertexarray);
+}
+
+void setpolygonmode (GLenum mode)
+{
+    GLState.calls++;
+    if (GLState.FillMode == mode)
+    {
+        GLState.skipped++;
+        return;
+    }
+    GLState.FillMode = mode;
+    glPolygonMode (GL_FRONT_AND_BACK, mode);
+}
+
+void createstreambuffer (StreamBuffer* stream, int capacity)
+{
+    stream->Capacity = capacity;
+    stream->Region = 0;
+    stream->Used = 0;
+    stream->Mapped = NULL;
+    for (int i = 0 ; i < stream_regions ; i++)
+    {
+        stream->Fences[i] = 0;
+    }
+
+    glGenBuffers (1, &(stream->Buffer));
+    glBindBuffer (GL_ARRAY_BUFFER, stream->Buffer);
+
+    stream->Persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+    if (stream->Persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage (GL_ARRAY_BUFFER, stream_regions*capacity, NULL, flags);
+        stream->Mapped = (char*)glMapBufferRange (GL_ARRAY_BUFFER, 0, stream_regions*capacity, flags);
+        stream->Persistent = stream->Mapped != NULL;
+    }
+    if (!stream->Persistent)
+    {
+        glBufferData (GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    }
+}
+
+/* Wait for the GPU to finish with the ring and free it */
+void destroystreambuffer (StreamBuffer* stream)
+{
+    for (int i = 0 ; i < stream_regions ; i++)
+    {
+        if (stream->Fences[i])
+        {
+            while (glClientWaitSync (stream->Fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync (stream->Fences[i]);
+            stream->Fences[i] = 0;
+        }
+    }
+    if (stream->Persistent)
+    {
+        glBindBuffer (GL_ARRAY_BUFFER, stream->Buffer);
+        glUnmapBuffer (GL_ARRAY_BUFFER);
+        stream->Mapped = NULL;
+    }
+    glDeleteBuffers (1, &(stream->Buffer));
+}
+
+/* Start the frame on the next region, waiting only if the GPU still reads it */
+void beginstreambuffer (StreamBuffer* stream)
+{
+    stream->Used = 0;
+    if (!stream->Persistent)
+    {
+        return;
+    }
+
+    stream->Region = (stream->Region + 1) % stream_regions;
+    GLsync fence = stream->Fences[stream->Region];
+    if (fence)
+    {
+        while (glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync (fence);
+        stream->Fences[stream->Region] = 0;
+    }
+}
+
+/* Append "bytes" of data for this frame, returns its offset in the buffer
+   for glVertexAttribPointer or -1 when the frame is out of room */
+int writestreambuffer (StreamBuffer* stream, const void* data, int bytes)
+{
+    if (stream->Used + bytes > stream->Capacity)
+    {
+        return -1;
+    }
+
+    int offset = stream->Used;
+    if (stream->Persistent)
+    {
+        offset += stream->Region * stream->Capacity;
+        memcpy (stream->Mapped + offset, data, bytes);
+    }
+    else
+    {
+        // Orphan on the first write of the frame only
+        glBindBuffer (GL_ARRAY_BUFFER, stream->Buffer);
+        if (offset == 0)
+        {
+            glBufferData (GL_ARRAY_BUFFER, stream->Capacity, NULL, GL_STREAM_DRAW);
+        }
+        glBufferSubData (GL_ARRAY_BUFFER, offset, bytes, data);
+    }
+    stream->Used += bytes;
+    return offset;
+}
+
+/* Called after the last command reading this frame's region */
+void endstreambuffer (StreamBuffer* stream)
+{
+    if (stream->Persistent && stream->Used > 0)
+    {
+        stream->Fences[stream->Region] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+/* Replace the start of a GPU-side buffer through the stream ring, so the
+   copy is queued behind the draws still reading the old contents.
+   False when the ring had no room and the buffer was left as it was */
+bool uploadrecords (StreamBuffer* stream, GLuint buffer, const void* data, int bytes)
+{
+    if (bytes == 0)
+    {
+        return true;
+    }
+
+    int offset = writestreambuffer(stream, data, bytes);
+    if (offset < 0)
+    {
+        return false;
+    }
+    glBindBuffer (GL_COPY_READ_BUFFER, stream->Buffer);
+    glBindBuffer (GL_COPY_WRITE_BUFFER, buffer);
+    glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, bytes);
+    return true;
+}
+
+void setblend (bool blend)
+{
+    GLState.calls++;
+    if (GLState.Blend == blend)
+    {
+        GLState.skipped++;
+        return;
+    }
+    GLState.Blend = blend;
+    // Blended edges don't write depth, they must not hide what is drawn after them
+    if (blend)
+    {
+        glEnable (GL_BLEND);
+        glDepthMask (GL_FALSE);
+    }
+    else
+    {
+        glDisable (GL_BLEND);
+        glDepthMask (GL_TRUE);
+    }
+}
+
+/* Geometry already uploaded, keyed by primitive, fill mode and vertex data */
+map<string, Geometry*> geometry_cache;
+
+/* Generate VAO, VBOs and return VAO handle - reuses the cached geometry when an identical shape exists */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
-    struct VAO* vao = new struct VAO;
-    vao->PrimitiveMode = primitive_mode;
-    vao->NumVertices = numVertices;
-    vao->FillMode = fill_mode;
+    struct VAO* vao = new struct VAO();
+
+    string key;
+    key.append((const char*)&primitive_mode, sizeof(primitive_mode));
+    key.append((const char*)&fill_mode, sizeof(fill_mode));
+    key.append((const char*)vertex_buffer_data, 3*numVertices*sizeof(GLfloat));
+    key.append((const char*)color_buffer_data, 3*numVertices*sizeof(GLfloat));
+
+    map<string, Geometry*>::iterator cached = geometry_cache.find(key);
+    if (cached != geometry_cache.end())
+    {
+        vao->geometry = cached->second;
+        return vao;
+    }
+
+    Geometry* geometry = new Geometry;
+    geometry->PrimitiveMode = primitive_mode;
+    geometry->NumVertices = numVertices;
+    geometry->FillMode = fill_mode;
+    geometry->Radius = 0;
 
     // Create Vertex Array Object
     // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
+    glGenVertexArrays(1, &(geometry->VertexArrayID)); // VAO
+    glGenBuffers (1, &(geometry->VertexBuffer)); // VBO - vertices
+    glGenBuffers (1, &(geometry->ColorBuffer));  // VBO - colors
 
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
+    bindvertexarray (geometry->VertexArrayID); // Bind the VAO
+    glBindBuffer (GL_ARRAY_BUFFER, geometry->VertexBuffer); // Bind the VBO vertices
     glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
     glVertexAttribPointer(
                           0,                  // attribute 0. Vertices
@@ -180,8 +488,9 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
                           0,                  // stride
                           (void*)0            // array buffer offset
                           );
+    glEnableVertexAttribArray(0); // enabled arrays are VAO state, set once here
 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
+    glBindBuffer (GL_ARRAY_BUFFER, geometry->ColorBuffer); // Bind the VBO colors
     glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
     glVertexAttribPointer(
                           1,                  // attribute 1. Color
@@ -191,6 +500,10 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
                           0,                  // stride
                           (void*)0            // array buffer offset
                           );
+    glEnableVertexAttribArray(1);
+
+    geometry_cache[key] = geometry;
+    vao->geometry = geometry;
 
     return vao;
 }
@@ -198,413 +511,315 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+    vector<GLfloat> color_buffer_data(3*numVertices);
     for (int i=0; i<numVertices; i++) {
         color_buffer_data [3*i] = red;
         color_buffer_data [3*i + 1] = green;
         color_buffer_data [3*i + 2] = blue;
     }
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
 }
 
-/* Render the VBOs handled by VAO */
+/* Render the VBOs handled by VAO. The VAO already holds the attribute arrays,
+   so only the fill mode and the VAO binding can change between draws */
 void draw3DObject (struct VAO* vao)
 {
+    Geometry* geometry = vao->geometry;
+
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+    setpolygonmode (geometry->FillMode);
 
     // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
+    bindvertexarray (geometry->VertexArrayID);
 
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    // Draw the geometry !
+    glDrawArrays(geometry->PrimitiveMode, 0, geometry->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+    GLState.draws++;
+}
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+/* Add a node under "parent", placed where the object was created */
+SceneNode* createnode (VAO* object, SceneNode* parent, glm::mat4 shape = glm::mat4(1.0f))
+{
+    SceneNode* node = new SceneNode;
+    node->object = object;
+    node->shape = shape;
+    node->x = object ? object->x : 0;
+    node->y = object ? object->y : 0;
+    node->angle = 0;
+    node->dirty = true;
+    node->camera_version = 0;
+    node->layer = layer_count++ * layer_step;
+    if (parent)
+    {
+        parent->children.push_back(node);
+    }
+    return node;
+}
 
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+/* Move a node within its parent, its subtree follows on the next updatescene */
+void placenode (SceneNode* node, float x, float y, float angle)
+{
+    if (node->x != x || node->y != y || node->angle != angle)
+    {
+        node->x = x;
+        node->y = y;
+        node->angle = angle;
+        node->dirty = true;
+    }
+}
+
+/* Rebuild the world matrices of moved nodes and everything below them */
+void updatescene (SceneNode* node, const glm::mat4& parentworld, bool parentmoved)
+{
+    bool moved = node->dirty || parentmoved;
+    if (moved)
+    {
+        node->world = parentworld * glm::translate(glm::vec3(node->x, node->y, 0))
+                      * glm::rotate((float)(node->angle*M_PI/180.0f), glm::vec3(0,0,1)) * node->shape;
+        node->dirty = false;
+        node->camera_version = 0;
+    }
+    for (int i = 0 ; i < node->children.size() ; i++)
+    {
+        updatescene(node->children[i], node->world, moved);
+    }
+}
+
+/* One object queued for drawing this frame */
+struct DrawItem {
+    VAO* object;
+    glm::mat4 MVP;
+    float layer;
+};
+
+vector<DrawItem> drawlist;
+
+/* Queue a subtree on the draw list */
+void drawscene (SceneNode* node)
+{
+    if (node->object)
+    {
+        if (node->camera_version != Camera.version)
+        {
+            node->MVP = Camera.VP * glm::translate(glm::vec3(0, 0, node->layer)) * node->world;
+            node->camera_version = Camera.version;
+        }
+        DrawItem item = { node->object, node->MVP, node->layer };
+        drawlist.push_back(item);
+    }
+    for (int i = 0 ; i < node->children.size() ; i++)
+    {
+        drawscene(node->children[i]);
+    }
+}
+
+bool drawitemorder (const DrawItem& a, const DrawItem& b)
+{
+    // Blended circles after the opaque shapes, back to front as they do not write depth
+    if ((a.object->geometry->Radius > 0) != (b.object->geometry->Radius > 0))
+    {
+        return b.object->geometry->Radius > 0;
+    }
+    if (a.object->geometry->Radius > 0)
+    {
+        return a.layer < b.layer;
+    }
+    if (a.object->geometry->FillMode != b.object->geometry->FillMode)
+    {
+        return a.object->geometry->FillMode < b.object->geometry->FillMode;
+    }
+    return a.object->geometry->VertexArrayID < b.object->geometry->VertexArrayID;
+}
+
+/* Draw the queued objects grouped by shader, fill mode and VAO. The opaque
+   pass leaves the blended circles queued, they go last, once the bricks and
+   lasers are drawn, so their antialiased edges blend over whatever is behind */
+void flushdrawlist (bool blended)
+{
+    if (!blended)
+    {
+        stable_sort(drawlist.begin(), drawlist.end(), drawitemorder);
+    }
+    int i = 0;
+    for ( ; i < drawlist.size() ; i++)
+    {
+        Geometry* geometry = drawlist[i].object->geometry;
+        if ((geometry->Radius > 0) != blended)
+        {
+            break;
+        }
+        if (geometry->Radius > 0)
+        {
+            useprogram (CircleBatch.ProgramID);
+            setblend (true);
+            glUniformMatrix4fv(CircleBatch.MVPID, 1, GL_FALSE, &drawlist[i].MVP[0][0]);
+            glUniform1f(CircleBatch.RadiusID, geometry->Radius);
+        }
+        else
+        {
+            useprogram (programID);
+            setblend (false);
+            glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &drawlist[i].MVP[0][0]);
+        }
+        draw3DObject(drawlist[i].object);
+    }
+    setblend (false);
+    drawlist.erase(drawlist.begin(), drawlist.begin() + i);
 }
 
 /**************************
  * Customizable functions *
  **************************/
-VAO *bask1, *bask2, *cannon_base, *cannon_gun, *brick, *segment,*laser,*line;
-vector<VAO*> circle,lasers,mirrors,bricks;
-vector<VAO*> baskcircle1,baskcircle2,smcircle,b2circle,b1circle;
-
-float triangle_rot_dir = 1;
-bool triangle_rot_status = true;
-float triangle_rotation = 1.0;
-bool cannon_gun_rot_status = true;
-float cannon_gun_rot_dir = 1;
-float cannon_gun_rotation = 0;
-float camera_rotation_angle = 90;
-float bask1_rotation = 0;
-int new_laser_index = -1;
-bool cannon_active = true;
-double latest_cannonfire_time = 0;
-int totalbrickcount = 0;
-float brick_falling_frequency = 0.25;
-double xpos, ypos;
-float mxpos,mypos;
-bool mouse_left_drag = false,mouse_right_drag = false;
-int drag_basket;
-float bx = 10.0f,bnx = -10.0f,by = 10.0f, bny = -10.0f;
-bool ctrlflag = false,altflag=false;
-bool gameover = false;
-int redbrickshit = 0,greenbrickshit = 0;
-int score = 0;
-int fbwidth = 600,fbheight = 600;
-
+VAO *bask1, *bask2, *cannon_gun, *brick, *laser, *mirror, *line;
+VAO *circle, *smcircle, *baskcircle1, *baskcircle2, *b1circle, *b2circle;
 
+SceneNode *scene, *cannon_node, *cannon_gun_node, *bask1_node, *bask2_node;
 
-void *playaudio (void* parg)
-{
-  const char* filepath = (const char*)parg;
-  ao_device* device;
-  ao_sample_format format;
-  int defaultDriver;
-  WavHeader header;
-
-  std::ifstream file;
-  file.open(filepath, std::ios::binary | std::ios::in);
-
-  file.read(header.id, sizeof(header.id));
-  assert(!std::memcmp(header.id, "RIFF", 4)); //is it a WAV file?
-  file.read((char*)&header.totalLength, sizeof(header.totalLength));
-  file.read(header.wavefmt, sizeof(header.wavefmt)); //is it the right format?
-  assert(!std::memcmp(header.wavefmt, "WAVEfmt ", 8));
-  file.read((char*)&header.format, sizeof(header.format));
-  file.read((char*)&header.pcm, sizeof(header.pcm));
-  file.read((char*)&header.channels, sizeof(header.channels));
-  file.read((char*)&header.frequency, sizeof(header.frequency));
-  file.read((char*)&header.bytesPerSecond, sizeof(header.bytesPerSecond));
-  file.read((char*)&header.bytesByCapture, sizeof(header.bytesByCapture));
-  file.read((char*)&header.bitsPerSample, sizeof(header.bitsPerSample));
-  file.read(header.data, sizeof(header.data));
-  file.read((char*)&header.bytesInData, sizeof(header.bytesInData));
-
-  ao_initialize();
-
-  defaultDriver = ao_default_driver_id();
-
-  memset(&format, 0, sizeof(format));
-  format.bits = header.format;
-  format.channels = header.channels;
-  format.rate = header.frequency;
-  format.byte_format = AO_FMT_LITTLE;
-
-  device = ao_open_live(defaultDriver, &format, NULL);
-  if (device == NULL) {
-      std::cout << "Unable to open driver" << std::endl;
+Game game;
 
-  }
+float camera_rotation_angle = 90;
+int max_substeps = 10; // most simulation steps run per frame at normal speed, scaled by time_scale
+double time_scale = 1; // game seconds per real second
+bool paused = false;
+bool render_stats = false; // report the GL state cache once a second
+int fbwidth = 600,fbheight = 600;
 
-  char* buffer = (char*)malloc(BUF_SIZE * sizeof(char));
+const char* record_path = NULL; // --record, input log written on quit
+InputLog replay_log; // --replay, live game input is ignored while it plays
+bool replaying = false;
+size_t replay_next = 0;
 
-  // determine how many BUF_SIZE chunks are in file
-  int fSize = header.bytesInData;
-  int bCount = fSize / BUF_SIZE;
+const char* snapshot_path = "game.snapshot"; // F5 saves the game here and F9 restores it
 
-  for (int i = 0; i < bCount; ++i) {
-      file.read(buffer, BUF_SIZE);
-      ao_play(device, buffer, BUF_SIZE);
-  }
+RewindBuffer Rewind; // the last --rewind seconds of play
+double rewind_seconds = 10;
+bool rewinding = false; // R held, the game runs backwards
 
-  int leftoverBytes = fSize % BUF_SIZE;
-  //std::cout << leftoverBytes;
-  file.read(buffer, leftoverBytes);
-  memset(buffer + leftoverBytes, 0, BUF_SIZE - leftoverBytes);
-  ao_play(device, buffer, BUF_SIZE);
-  ao_close(device);
-  ao_shutdown();
+/* The game was replaced and its versions start over, so the records cached
+   for the old one must not be taken for current. A snapshot may also hold
+   more brick slots or lasers than the buffers were made for */
+void rebuildrecords ()
+{
+    BrickBatch.version = game.bricks.version - 1;
+    LaserBatch.version = game.lasers_version - 1;
 
+    int bricks = game.bricks.x.size(), lasers = game.lasers.size();
+    if (bricks > BrickBatch.capacity)
+    {
+        glBindBuffer (GL_ARRAY_BUFFER, BrickBatch.RecordBuffer);
+        glBufferData (GL_ARRAY_BUFFER, bricks*sizeof(BrickInstance), NULL, GL_DYNAMIC_DRAW);
+        BrickBatch.capacity = bricks;
+    }
+    if (lasers > LaserBatch.capacity)
+    {
+        glBindBuffer (GL_ARRAY_BUFFER, LaserBatch.RecordBuffer);
+        glBufferData (GL_ARRAY_BUFFER, lasers*sizeof(LaserInstance), NULL, GL_DYNAMIC_DRAW);
+        LaserBatch.capacity = lasers;
+    }
 
+    int bytes = bricks*sizeof(BrickInstance) + lasers*sizeof(LaserInstance);
+    if (bytes > DynamicBuffer.Capacity)
+    {
+        destroystreambuffer(&DynamicBuffer);
+        createstreambuffer(&DynamicBuffer, bytes);
+    }
 }
-void playwav (const char* x)
+
+void savereplay ()
 {
-  pthread_t      tid;  // thread ID
-  pthread_attr_t attr; // thread attribute
+    if (record_path != NULL && game.recording)
+    {
+        if (!saveinputlog(&game, record_path))
+        {
+            cout << "Unable to write " << record_path << endl;
+        }
+        game.recording = false;
+    }
+}
 
-  // set thread detachstate attribute to DETACHED
-  pthread_attr_init(&attr);
-  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
-  // create the thread
-  const char* parg = x;
-  pthread_create(&tid, &attr, playaudio, (void *)parg);
+/*executed when something is pressed*/
+
+/* Game key driven by each GLFW key, -1 when the game ignores it */
+int gamekeyfor (int key)
+{
+    switch (key) {
+        case GLFW_KEY_SPACE: return GAME_KEY_FIRE;
+        case GLFW_KEY_A: return GAME_KEY_TILT_UP;
+        case GLFW_KEY_D: return GAME_KEY_TILT_DOWN;
+        case GLFW_KEY_S: return GAME_KEY_CANNON_DOWN;
+        case GLFW_KEY_F: return GAME_KEY_CANNON_UP;
+        case GLFW_KEY_M: return GAME_KEY_FASTER;
+        case GLFW_KEY_N: return GAME_KEY_SLOWER;
+        case GLFW_KEY_LEFT: return GAME_KEY_LEFT;
+        case GLFW_KEY_RIGHT: return GAME_KEY_RIGHT;
+        case GLFW_KEY_UP: return GAME_KEY_UP;
+        case GLFW_KEY_DOWN: return GAME_KEY_DOWN;
+        case GLFW_KEY_LEFT_ALT: return GAME_KEY_RED_BASKET;
+        case GLFW_KEY_LEFT_CONTROL: return GAME_KEY_GREEN_BASKET;
+        default: return -1;
+    }
+}
 
+GameAction gameactionfor (int action)
+{
+    return action == GLFW_PRESS ? GAME_PRESS : (action == GLFW_REPEAT ? GAME_REPEAT : GAME_RELEASE);
 }
+
 /*executed when something is pressed*/
 
 void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 {
      // Function is called first on GLFW_PRESS.
 
-    if (action == GLFW_RELEASE) {
-        switch (key) {
-            case GLFW_KEY_LEFT_CONTROL:
-                ctrlflag = false;
-                break;
-            case GLFW_KEY_LEFT_ALT:
-                altflag = false;
-                break;
+    if (key == GLFW_KEY_ESCAPE && action != GLFW_RELEASE)
+    {
+        quit(window);
+        return;
+    }
 
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    {
+        paused = !paused;
+        return;
+    }
 
-            default:
-                break;
+    if (key == GLFW_KEY_F5 && action == GLFW_PRESS)
+    {
+        if (!savesnapshot(&game, snapshot_path))
+        {
+            cout << "Unable to write " << snapshot_path << endl;
         }
+        return;
     }
-    else if ((action == GLFW_REPEAT)||(action == GLFW_PRESS)) {
-        switch (key) {
-            case GLFW_KEY_ESCAPE:
-                quit(window);
-                break;
-
-            case GLFW_KEY_LEFT_CONTROL:
-                ctrlflag = true;
-                break;
-            case GLFW_KEY_LEFT_ALT:
-                altflag = true;
-                break;
-
-            case GLFW_KEY_SPACE :
-                if ((action == GLFW_PRESS) && (cannon_active))
-                {
-                  new_laser_index = (new_laser_index + 1) % lasers.size();
-                  lasers[new_laser_index]->inclination = cannon_gun_rotation;
-                  lasers[new_laser_index]->x = cannon_gun->x + 2*cos(lasers[new_laser_index]->inclination*M_PI/180.0f);
-                  lasers[new_laser_index]->y = cannon_gun->y + 2*sin(lasers[new_laser_index]->inclination*M_PI/180.0f);
-                  lasers[new_laser_index]->z = cannon_gun->z;
-                  lasers[new_laser_index]->active = true;
-                  cannon_active = false;
-                  latest_cannonfire_time = glfwGetTime();
-                }
-                //playaudio("laser.wav");
-                break;
-
-            case GLFW_KEY_M :
-                brick_falling_frequency -= 0.1;
-                if (brick_falling_frequency < 0.05)
-                {
-                  brick_falling_frequency = 0.05;
-                }
-                break;
-
-            case GLFW_KEY_N :
-                brick_falling_frequency += 0.1;
-                if (brick_falling_frequency > 0.45)
-                {
-                  brick_falling_frequency = 0.45;
-                }
-                break;
-
-            case GLFW_KEY_S :
-
-                if (cannon_gun->y <= -5.5)
-                {
-                  cannon_gun->y = -5.5;
-                }
-                cannon_gun->y = cannon_gun->y <= -5.5 ? -5.5 : cannon_gun->y  - 0.5;
-
-                for(int j = 0 ; j < circle.size() ; j++)
-                {
-                  circle[j]->y = circle[j]->y <= -5.5 ? -5.5 : circle[j]->y  - 0.5;
-                }
-                for(int j = 0 ; j < smcircle.size() ; j++)
-                {
-                  smcircle[j]->y = smcircle[j]->y <= -5.5 ? -5.5 : smcircle[j]->y  - 0.5;
-                }
-
-                break;
-
-            case GLFW_KEY_F :
-
-                cannon_gun->y = cannon_gun->y >=8 ? 8 : cannon_gun->y  + 0.5;
-
-                for(int j = 0 ; j < circle.size() ; j++)
-                {
-                  circle[j]->y = circle[j]->y >=8 ? 8 : circle[j]->y  + 0.5;
-                }
-                for(int j = 0 ; j < smcircle.size() ; j++)
-                {
-                  smcircle[j]->y = smcircle[j]->y >=8 ? 8 : smcircle[j]->y  + 0.5;
-                }
-
-                break;
-
-            case GLFW_KEY_A :
-                cannon_gun_rot_status = true;
-                cannon_gun_rot_dir = 1;
-                if ( ((cannon_gun_rotation < 90 )&&(cannon_gun_rotation > -90))
-                     || ((cannon_gun_rotation == 90) && (cannon_gun_rot_dir == -1))
-                     || ((cannon_gun_rotation == -90) && (cannon_gun_rot_dir == 1))
-                   )
-                {
-                    cannon_gun_rotation = cannon_gun_rotation + cannon_gun_rot_dir*cannon_gun_rot_status;
-                }
-                break;
-
-            case GLFW_KEY_D :
-                cannon_gun_rot_status = true;
-                cannon_gun_rot_dir = -1;
-                if ( ((cannon_gun_rotation < 90 )&&(cannon_gun_rotation > -90))
-                     || ((cannon_gun_rotation == 90) && (cannon_gun_rot_dir == -1))
-                     || ((cannon_gun_rotation == -90) && (cannon_gun_rot_dir == 1))
-                   )
-                {
-                    cannon_gun_rotation = cannon_gun_rotation + cannon_gun_rot_dir*cannon_gun_rot_status;
-                }
-                break;
-
-            case GLFW_KEY_LEFT :
-                if (altflag)
-                {
-                  bask1->x -= 0.5;
-                  for (int j = 0 ; j < baskcircle1.size(); j ++)
-                  {
-                    baskcircle1[j]->x -= 0.5;
-                  }
-                  for (int j = 0 ; j < b1circle.size(); j ++)
-                  {
-                    b1circle[j]->x -= 0.5;
-                  }
-                  if (bask1->x <= -8.5)
-                  {
-                    bask1->x = -8.5;
-                    for (int j = 0 ; j < baskcircle1.size(); j ++)
-                    {
-                      baskcircle1[j]->x = -8.5;
-                    }
-                    for (int j = 0 ; j < b1circle.size(); j ++)
-                    {
-                      b1circle[j]->x = -8.5;
-                    }
-                  }
-                }
-                else if (ctrlflag)
-                {
-                  bask2->x -= 0.5;
-                  for (int j = 0 ; j < baskcircle2.size(); j ++)
-                  {
-                    baskcircle2[j]->x -= 0.5;
-                  }
-                  for (int j = 0 ; j < b2circle.size(); j ++)
-                  {
-                    b2circle[j]->x -= 0.5;
-                  }
-                  if (bask2->x <= -8.5)
-                  {
-                    bask2->x = -8.5;
-                    for (int j = 0 ; j < baskcircle2.size(); j ++)
-                    {
-                      baskcircle2[j]->x = -8.5;
-                    }
-                    for (int j = 0 ; j < b2circle.size(); j ++)
-                    {
-                      b2circle[j]->x = -8.5;
-                    }
-                  }
-                }
-                else
-                {
-                  if (bnx - 1 >= -10)
-                  {
-                    bx--;
-                    bnx--;
-                  }
-                  Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
-                }
-
-                break;
-            case GLFW_KEY_RIGHT :
-
-                if (altflag)
-                {
-                  bask1->x += 0.5;
-                  for (int j = 0 ; j < baskcircle1.size(); j ++)
-                  {
-                    baskcircle1[j]->x += 0.5;
-                  }
-                  for (int j = 0 ; j < b1circle.size(); j ++)
-                  {
-                    b1circle[j]->x += 0.5;
-                  }
-                  if (bask1->x >= 8.5)
-                  {
-                    for (int j = 0 ; j < baskcircle1.size(); j ++)
-                    {
-                      baskcircle1[j]->x = 8.5;
-                    }
-                    for (int j = 0 ; j < b1circle.size(); j ++)
-                    {
-                      b1circle[j]->x = 8.5;
-                    }
-                    bask1->x = 8.5;
-                  }
-                }
-                else if (ctrlflag)
-                {
-                  bask2->x += 0.5;
-                  for (int j = 0 ; j < baskcircle2.size(); j ++)
-                  {
-                    baskcircle2[j]->x += 0.5;
-                  }
-                  for (int j = 0 ; j < b2circle.size(); j ++)
-                  {
-                    b2circle[j]->x += 0.5;
-                  }
-                  if (bask2->x >= 8.5)
-                  {
-                    bask2->x = 8.5;
-                    for (int j = 0 ; j < baskcircle2.size(); j ++)
-                    {
-                      baskcircle2[j]->x = 8.5;
-                    }
-                    for (int j = 0 ; j < b2circle.size(); j ++)
-                    {
-                      b2circle[j]->x = 8.5;
-                    }
-                  }
-                }
-                else
-                {
-                  if (bx + 1 <= 10 )
-                  {
-                    bx++;
-                    bnx++;
-                  }
-                  Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
-                }
-
-                break;
-
-            case GLFW_KEY_UP :
-                bnx = bnx >= -5 ? -5 : bnx + 1;
-                bny = bny >= -5 ? -5 : bny + 1;
-                bx = bx <= 5 ? 5 : bx - 1;
-                by = by <= 5 ? 5 : by - 1;
-                Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
-                break;
-
-            case GLFW_KEY_DOWN :
-
-                bnx = bnx <= -10 ? -10 : bnx - 1;
-                bny = bny <= -10 ? -10 : bny - 1;
-                bx = bx >= 10 ? 10 : bx + 1;
-                by = by >= 10 ? 10 : by + 1;
-                Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
-                break;
-
-            default:
-                break;
+
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS && !replaying)
+    {
+        // The input log only replays from the seed, so it ends here
+        savereplay();
+        if (loadsnapshot(&game, snapshot_path))
+        {
+            rebuildrecords();
+            initrewind(&Rewind, Rewind.capacity);
         }
+        else
+        {
+            cout << "Unable to read snapshot " << snapshot_path << endl;
+        }
+        return;
+    }
+
+    if (key == GLFW_KEY_R && !replaying)
+    {
+        rewinding = action != GLFW_RELEASE;
+        return;
+    }
+
+    int gamekeycode = gamekeyfor(key);
+    if (gamekeycode >= 0 && !replaying)
+    {
+        gamekey(&game, (GameKey)gamekeycode, gameactionfor(action));
     }
 }
 
@@ -621,137 +836,19 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 	}
 }
 
-float parse (float x)
-{
-  float integer,frac = modf(x, &integer);
-//  cout << integer << "+ " << frac << endl;
-  if (frac >= 0.75 )
-  {
-    return integer + 1;
-  }
-  else if (frac < 0.75 && frac >=0.25)
-  {
-    return integer + 0.5;
-  }
-  else if (frac < 0.25 && frac >= -0.25)
-  {
-    return integer;
-  }
-  else if (frac < -0.25 && frac >= -0.75)
-  {
-    return integer - 0.5;
-  }
-  else if ( frac <= -0.75)
-  {
-    return integer - 1;
-  }
-}
-
 /* Executed when a mouse button is pressed/released */
 void mouseButton (GLFWwindow* window, int button, int action, int mods)
 {
+    if (replaying)
+    {
+        return;
+    }
     switch (button) {
         case GLFW_MOUSE_BUTTON_LEFT:
-
-            if (action == GLFW_PRESS)
-            {
-              mouse_left_drag = true;
-
-              if (xpos >= -9 && ypos > -7.5 && cannon_active
-                  && (sqrt((cannon_gun->x-xpos)*(cannon_gun->x-xpos)
-                  +(cannon_gun->y-ypos)*(cannon_gun->y-ypos)) > 1)
-                  )
-              {
-                cannon_gun_rotation = atan((double)(ypos - cannon_gun->y)/
-                                              (xpos - cannon_gun->x))*180/M_PI;
-                new_laser_index = (new_laser_index + 1) % lasers.size();
-                lasers[new_laser_index]->inclination = cannon_gun_rotation;
-                lasers[new_laser_index]->x = cannon_gun->x + 2*cos(lasers[new_laser_index]->inclination*M_PI/180.0f);
-                lasers[new_laser_index]->y = cannon_gun->y + 2*sin(lasers[new_laser_index]->inclination*M_PI/180.0f);
-                lasers[new_laser_index]->z = cannon_gun->z;
-                lasers[new_laser_index]->active = true;
-                cannon_active = false;
-                latest_cannonfire_time = glfwGetTime();
-
-                playwav("laser.wav");
-
-              }
-
-
-            }
-
-            if (action == GLFW_RELEASE)
-            {
-            //  cout << "released" << endl;
-
-              mouse_left_drag = false;
-
-              if (cannon_gun->drag == true)
-              {
-                cannon_gun->drag = false;
-                cannon_gun->y = parse(cannon_gun->y);
-                //cout << "final " << cannon_gun->y <<endl;
-                for (int j = 0 ; j < circle.size() ; j++)
-                {
-                  circle[j]->drag = false;
-                  circle[j]->y = parse(circle[j]->y);
-                }
-                for (int j = 0 ; j < smcircle.size() ; j++)
-                {
-                  smcircle[j]->drag = false;
-                  smcircle[j]->y = parse(smcircle[j]->y);
-                }
-              }
-              if (bask1->drag == true)
-              {
-                bask1->drag = false;
-                bask1->x = parse(bask1->x);
-                for ( int j = 0 ;j < baskcircle1.size() ; j++)
-                {
-                  baskcircle1[j]->drag = false;
-                  baskcircle1[j]->x = parse(baskcircle1[j]->x);
-                }
-                for ( int j = 0 ;j < b1circle.size() ; j++)
-                {
-                  b1circle[j]->drag = false;
-                  b1circle[j]->x = parse(b1circle[j]->x);
-                }
-
-              }
-
-              if (bask2->drag == true)
-              {
-                bask2->drag = false;
-                bask2->x = parse(bask2->x);
-                for ( int j = 0 ;j < baskcircle2.size() ; j++)
-                {
-                  baskcircle2[j]->drag = false;
-                  baskcircle2[j]->x = parse(baskcircle2[j]->x);
-                }
-                for ( int j = 0 ;j < b2circle.size() ; j++)
-                {
-                  b2circle[j]->drag = false;
-                  b2circle[j]->x = parse(b2circle[j]->x);
-                }
-
-              }
-
-            }
-
+            gamebutton(&game, GAME_BUTTON_LEFT, gameactionfor(action));
             break;
-
         case GLFW_MOUSE_BUTTON_RIGHT:
-            if (action == GLFW_PRESS)
-            {
-              mouse_right_drag = true;
-              mxpos = xpos;
-              mypos = ypos;
-
-            }
-            if (action == GLFW_RELEASE)
-            {
-                mouse_right_drag = false;
-            }
+            gamebutton(&game, GAME_BUTTON_RIGHT, gameactionfor(action));
             break;
         default:
             break;
@@ -760,30 +857,18 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
-  if (yoffset == 1)
-  {
-    bnx = bnx >= -5 ? -5 : bnx + 1;
-    bny = bny >= -5 ? -5 : bny + 1;
-    bx = bx <= 5 ? 5 : bx - 1;
-    by = by <= 5 ? 5 : by - 1;
-    Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
-  }
-  else if (yoffset == -1)
+  if (!replaying)
   {
-    bnx = bnx <= -10 ? -10 : bnx - 1;
-    bny = bny <= -10 ? -10 : bny - 1;
-    bx = bx >= 10 ? 10 : bx + 1;
-    by = by >= 10 ? 10 : by + 1;
-    Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
+    gamescroll(&game, yoffset);
   }
 }
 
 void cursor_pos_callback(GLFWwindow* window, double x, double y)
 {
-
-  xpos = x/(fbwidth/20.0) -10;
-  ypos = -(y/(fbheight/20.0) -10);
-  //cout << fbheight <<" "<<  fbwidth <<endl;
+  if (!replaying)
+  {
+    gamepointer(&game, x/(fbwidth/20.0) -10, -(y/(fbheight/20.0) -10));
+  }
 }
 
 
@@ -811,84 +896,60 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     // Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
 
     // Ortho projection for 2D views
-    Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
+    Matrices.projection = glm::ortho(game.bnx, game.bx, game.bny, game.by, 0.1f, 500.0f);
 }
 
 
 
-VAO* createsegment(GLfloat v1, GLfloat v2 , GLfloat v3,
-                    GLfloat v4, GLfloat v5, GLfloat v6,
-                    GLfloat c1, GLfloat c2, GLfloat c3,
-                    GLfloat c4, GLfloat c5, GLfloat c6,
-                    GLfloat c7, GLfloat c8, GLfloat c9,
-                    float x,float y,float z, GLfloat r
-                  )
+/* Build a circle as the square strip around it, centred on the origin and
+   translated to (x,y,z) at draw time. The circle shader cuts the disc out of
+   it per pixel, so it stays round at any zoom */
+VAO* createcirclemesh(GLfloat r, GLfloat red, GLfloat green, GLfloat blue,
+                      float x, float y, float z)
 {
   GLfloat vertex_buffer_data [] = {
-    v1, v2,v3, // vertex 0
-    v4,r,v6, // vertex 1
-    r*sin(10*M_PI/180.0f),r*cos(10*M_PI/180.0f),0, // vertex 2
+    -r,-r,0,
+     r,-r,0,
+    -r, r,0,
+     r, r,0,
   };
 
-  GLfloat color_buffer_data [] = {
-    c1,c2 ,c3, // color 0
-    c4,c5,c6, // color 1
-    c7,c8,c9, // color 2
-  };
+  // Only circles use strips, so the geometry cache never hands this to a rectangle
+  VAO* mesh = create3DObject(GL_TRIANGLE_STRIP, 4, vertex_buffer_data, red, green, blue, GL_FILL);
+  mesh->geometry->Radius = r;
+  mesh->x = x;
+  mesh->y = y;
+  mesh->z = z;
 
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  segment = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_FILL);
-  segment->x = x;
-  segment->y = y;
-  segment->z = z;
-  segment->drag = false;
-
-  return segment;
+  return mesh;
 }
 
 
 void createcirclebottom1()
 {
-  for (int i = 0 ; i < 37 ; i++)
-  {
-    b1circle.push_back(createsegment(0,0,0, 0,1.5,0,
-      1,0,0, 1,0,0, 1,0,0, 5,-9.5,0, 1.5));
-  }
+  b1circle = createcirclemesh(1.5, 1,0,0, 0,-0.5,0); // relative to the red basket
 }
 
 void createcirclebottom2()
 {
-  for (int i = 0; i < 37; i++)
-  {
-    b2circle.push_back(createsegment(0,0,0, 0,1.5,0, 0,1,0, 0,1,0, 0,1,0, -5,-9.5,0, 1.5));
-  }
+  b2circle = createcirclemesh(1.5, 0,1,0, 0,-0.5,0); // relative to the green basket
 }
 
 void createsmallcircle()
 {
-  for (int i = 0 ; i < 37 ; i++)
-  {
-    smcircle.push_back(createsegment(0,0,0, 0,0.5,0, 0.8,0.3,1, 0.8,0.3,1, 0.8,0.3,1, -9,0,0, 0.5));
-  }
+  smcircle = createcirclemesh(0.5, 0.8,0.3,1, 0,0,0); // relative to the cannon
 }
 
 void createcircle ()
 {
-  int i = 0;
-  for( i = 0 ; i < 37 ; i++)
-  {
-    circle.push_back(createsegment(0,0,0, 0,1,0, 0.6,0.2,0, 0.6,0.2,0, 0.6,0.2,0, -9,0,0, 1));
-  }
+  circle = createcirclemesh(1, 0.6,0.2,0, 0,0,0); // relative to the cannon
 }
 
 void createbaskcircle ()
 {
-  int i = 0;
-  for ( i = 0 ; i < 37 ; i++)
-  {
-    baskcircle1.push_back(createsegment(0,0,0, 0,1.5,0, 0,0,0,0,0,0,0,0,0, 5,-8,0, 1.5));
-    baskcircle2.push_back(createsegment(0,0,0, 0,1.5,0, 0,0,0,0,0,0,0,0,0, -5,-8,0, 1.5));
-  }
+  // rims, relative to their baskets
+  baskcircle1 = createcirclemesh(1.5, 0,0,0, 0,1,0);
+  baskcircle2 = createcirclemesh(1.5, 0,0,0, 0,1,0);
 }
 
 
@@ -920,7 +981,6 @@ VAO* createTriangle (
   triangle->x = x;
   triangle->y = y;
   triangle->z = z;
-  triangle->drag = false;
 
   return triangle;
 
@@ -933,15 +993,30 @@ void createline ()
 }
 
 
-void createlasers()
+/* One unit-length beam, instanced at every active laser */
+void createlaser()
 {
-  for (int i = 0 ; i < 20 ; i++)
-  {
-    VAO* laser = createTriangle(0,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 0, 0, 0);
-    laser->active = false;
-    laser->reflection = false;
-    lasers.push_back(laser);
-  }
+  laser = createTriangle(0,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 0, 0, 0);
+
+  bindvertexarray (laser->geometry->VertexArrayID);
+
+  // One record per laser of the game
+  glGenBuffers (1, &(LaserBatch.RecordBuffer));
+  glBindBuffer (GL_ARRAY_BUFFER, LaserBatch.RecordBuffer);
+  glBufferData (GL_ARRAY_BUFFER, game.lasers.size()*sizeof(LaserInstance), NULL, GL_DYNAMIC_DRAW);
+  LaserBatch.capacity = game.lasers.size();
+
+  // attribute 2. Leg start and direction, advanced once per laser
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(LaserInstance), (void*)0);
+  glVertexAttribDivisor(2, 1);
+
+  // attribute 3. Time the leg started, advanced once per laser
+  glEnableVertexAttribArray(3);
+  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(LaserInstance), (void*)(3*sizeof(GLfloat)));
+  glVertexAttribDivisor(3, 1);
+
+  LaserBatch.version = game.lasers_version - 1;
 }
 
 
@@ -982,332 +1057,185 @@ VAO* createrectangle (GLfloat v1, GLfloat v2 , GLfloat v3,
  rectangle->x = x;
  rectangle->y = y;
  rectangle->z = z;
- rectangle->active = true;
- rectangle->drag = false;
 
  return rectangle;
 
 }
 
-VAO* createmirror(float x, float y, float z,float tita)
+/* One mirror mesh, drawn at every mirror of the game */
+void createmirror()
 {
-  VAO* mirror = createrectangle(-1,-0.2,0 ,1,-0.2,0 ,1,0,0 ,-1,0,0,
-                    0.6,0.7,0.6, 0.6,0.7,0.6, 0.6,0.7,0.6, 0.6,0.7,0.6, x,y,z);
-  mirror->angle = tita;
-  return mirror;
+  mirror = createrectangle(-1,-0.2,0 ,1,-0.2,0 ,1,0,0 ,-1,0,0,
+                    0.6,0.7,0.6, 0.6,0.7,0.6, 0.6,0.7,0.6, 0.6,0.7,0.6, 0,0,0);
 }
 
-void createmirrors()
-{
-  mirrors.push_back(createmirror(0,0,0,30));
-  mirrors.push_back(createmirror(0,5,0,150));
-  mirrors.push_back(createmirror(5,-5,0,45));
-}
+/* Colour of each brick type, indexed by BrickPool::color */
+static const GLfloat brick_colors[3][3] = {
+  {0,0,0}, // black
+  {1,0,0}, // red
+  {0,1,0}, // green
+};
 
-VAO* createbrick (int colour, GLfloat X)
+/* Shared 0.7x0.7 brick quad plus the per-instance position/colour buffer.
+   The quad is white so its cache entry is never shared with a drawn rectangle,
+   since the instance attributes below are added to its VAO */
+void createbrickquad ()
 {
-  VAO* Brick;
-  if (colour == 2)//blue
-  {
-    Brick = createrectangle(0,0,0, 0.7,0,0, 0.7,0.7,0,  0,0.7,0,
-                              0,1,0, 0,1,0, 0,1,0, 0,1,0, X,10.0,0);
-    Brick->color = 2;
-  }
-  else if (colour == 1)//red
-  {
-    Brick = createrectangle(0,0,0, 0.7,0,0, 0.7,0.7,0,  0,0.7,0,
-                              1,0,0, 1,0,0, 1,0,0, 1,0,0, X,10.0,0);
-      Brick->color = 1;
-  }
-  else if (colour == 0)//black
-  {
-    Brick = createrectangle(0,0,0, 0.7,0,0, 0.7,0.7,0,  0,0.7,0,
-                              0,0,0, 0,0,0, 0,0,0, 0,0,0, X,10.0,0);
-    Brick->color = 0;
-  }
-  return Brick;
+  brick = createrectangle(0,0,0, 0.7,0,0, 0.7,0.7,0,  0,0.7,0,
+                            1,1,1, 1,1,1, 1,1,1, 1,1,1, 0,0,0);
 
-}
+  bindvertexarray (brick->geometry->VertexArrayID);
 
-void createbricks ()
-{
-  int Y = rand()%8 + 1;
-  //cout << "Y =" <<Y << endl;
-  vector<GLfloat> a;
-  for (int j =0 ; j < Y ; j++)
-  {
-    GLfloat X = rand()%17 - 7;
-    int colour = rand()%3;
-    //cout << "X = " << X <<endl;
-    int k = 0;
-    for ( k = 0 ; k < a.size(); k++)
-    {
-      if (a[k] == X)
-      {
-        break;
-      }
-    }
-    int u = 0;
-    for ( u =0 ; u < mirrors.size();u++)
-    {
-      if ( X <= mirrors[u]->x + fabs(cos(mirrors[u]->angle*M_PI/180.0f)) &&
-           X >= mirrors[u]->x - fabs(cos(mirrors[u]->angle*M_PI/180.0f))-0.7
-          )
-          {
-            break;
-          }
-    }
-    if ( k == a.size() && u == mirrors.size())
-    {
-      bricks.push_back(createbrick(colour,X));
-      a.push_back(X);
-    }
-
-  }
+  // One record per brick slot of the pool
+  glGenBuffers (1, &(BrickBatch.RecordBuffer));
+  glBindBuffer (GL_ARRAY_BUFFER, BrickBatch.RecordBuffer);
+  glBufferData (GL_ARRAY_BUFFER, game.bricks.x.size()*sizeof(BrickInstance), NULL, GL_DYNAMIC_DRAW);
+  BrickBatch.capacity = game.bricks.x.size();
 
-  totalbrickcount += Y;
+  // attribute 2. Instance column and spawn fall, advanced once per brick
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(BrickInstance), (void*)0);
+  glVertexAttribDivisor(2, 1);
 
+  // attribute 3. Instance colour, advanced once per brick
+  glEnableVertexAttribArray(3);
+  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(BrickInstance), (void*)(2*sizeof(GLfloat)));
+  glVertexAttribDivisor(3, 1);
 
+  BrickBatch.version = game.bricks.version - 1;
 }
 
-
-void createcannon ()
-{
-  cannon_gun = createrectangle( 0,-0.2,0, 2,-0.2,0, 2, 0.2,0, 0, 0.2,0,
-                                0.8,0.3,1, 0.8,0.3,1, 0.8,0.3,1, 0.8,0.3,1, -9.0,0.0,0.0 );
-
-}
-
-// Creates the rectangle object used in this sample code
-void createbaskets ()
-{
-  bask1 = createrectangle(-1.5,-0.5,0, 1.5,-0.5,0, 1.5, 1,0, -1.5,1,0,
-                          1,0,0, 1,0,0, 1,0,0, 1,0,0, 5.0,-9.0,0.0 );
-  bask1->active = true;
-  bask1->brickcount = 0;
-  bask2 = createrectangle(-1.5,-0.5,0, 1.5,-0.5,0, 1.5, 1,0, -1.5,1,0,
-                          0,1,0, 0,1,0, 0,1,0, 0,1,0, -5.0,-9.0,0.0 );
-  bask2->active = true;
-  bask2->brickcount = 0;
-}
-
-void checkcollisionbtwbaskets()
+/* Rebuild the brick records when a brick has spawned or gone since the last frame */
+void updatebrickrecords ()
 {
-  if (fabs(bask1->x - bask2->x) < 3)
+  if (BrickBatch.version == game.bricks.version)
   {
-    bask1->active = false;
-    bask2->active = false;
-    //cout << "not active " << endl;
+    return;
   }
-  else
+  BrickBatch.version = game.bricks.version;
+
+  // Floats lose centimetres after hours of falling, so the records and the
+  // uniform only hold the fall since now, which stays small until the next
+  // spawn or catch rebuilds them
+  BrickBatch.fall_base = falldistance(&game);
+  BrickBatch.instances.clear();
+  for (int k = 0; k < game.bricks.active.size(); k++)
   {
-    bask1->active = true;
-    bask2->active = true;
-    //cout << "active" << endl;
+    int j = game.bricks.active[k];
+    int color = game.bricks.color[j];
+
+    BrickInstance instance = { game.bricks.x[j], (GLfloat)(game.bricks.fall[j] - BrickBatch.fall_base),
+                               brick_colors[color][0],
+                               brick_colors[color][1],
+                               brick_colors[color][2] };
+    BrickBatch.instances.push_back(instance);
   }
-}
-
-VAO* checkcollisionbtwbrickbasket(VAO* Brick)
-{
-  if (Brick->y == -8.0 )
+  // Draw nothing rather than past the records, and try again next frame
+  BrickBatch.count = BrickBatch.instances.size();
+  if (BrickBatch.count > BrickBatch.capacity ||
+      !uploadrecords(&DynamicBuffer, BrickBatch.RecordBuffer, BrickBatch.instances.data(), BrickBatch.count*sizeof(BrickInstance)))
   {
-    if (((Brick->x >= bask2->x - 1.5)&&(Brick->x <=bask2->x + 0.8))
-          &&(bask2->active == true)&&(Brick->active == true))
-    {
-      if (Brick->color == 2)
-      {
-        Brick->active = false;
-        bask2->brickcount++;
-        score += 20;
-        cout << "score " << score << endl;
-      }
-      else if (Brick->color == 0)
-      {
-        gameover = true;
-      }
-
-    }
-
-    if (((Brick->x >= bask1->x - 1.5)&&(Brick->x <=bask1->x + 0.8))
-        &&(bask1->active == true) && (Brick->active == true))
-    {
-      if ( Brick->color == 1)
-      {
-        Brick->active = false;
-        bask1->brickcount++;
-        score += 20;
-        cout << "score " << score << endl;
-      }
-      else if (Brick->color == 0)
-      {
-        gameover = true;
-      }
-
-    }
-
-    //cout << "bask2 = " << bask2->brickcount <<"bask1 = "<< bask1->brickcount << endl;
+    BrickBatch.count = 0;
+    BrickBatch.version = game.bricks.version - 1;
   }
-
-  return Brick;
 }
 
-bool checkcollisionwithwalls( VAO* Laser)
+/* Rebuild the laser records when a laser has fired, turned or died */
+void updatelaserrecords ()
 {
-  float x = Laser->x + 1*cos(Laser->inclination*M_PI/180.0f);
-  float y = Laser->y + 1*sin(Laser->inclination*M_PI/180.0f);
-
-  if (( x > 10) || (x < -10) || (y > 10) || (y < -7.5))
-  {
-    return true;
-  }
-  else
+  if (LaserBatch.version == game.lasers_version)
   {
-    return false;
+    return;
   }
-}
+  LaserBatch.version = game.lasers_version;
 
-bool checkintersection (float x1 , float y1,float x2, float y2, float x3, float y3, float x4 , float y4)
-{
-  bool statement = ( (
-                        ((y3-y1)*(x2-x1)-(y2-y1)*(x3-x1))*
-                        ((y4-y1)*(x2-x1)-(y2-y1)*(x4-x1)) < 0
-                     ) &&
-                     (
-                       ((y1-y3)*(x4-x3)-(y4-y3)*(x1-x3))*
-                       ((y2-y3)*(x4-x3)-(y4-y3)*(x2-x3)) < 0
-                     )
-                   );
-  if (statement)
+  // Times are kept relative to now for the same reason as the brick falls,
+  // a laser turns or dies within seconds
+  LaserBatch.time_base = game.sim_time;
+  LaserBatch.instances.clear();
+  for (int j = 0 ; j < game.lasers.size(); j++)
   {
-    return true;
+    const Laser& beam = game.lasers[j];
+    if (beam.active == true)
+    {
+      LaserInstance instance = { beam.pathx[beam.leg], beam.pathy[beam.leg],
+                                 beam.pathangle[beam.leg], (GLfloat)(beam.legtime - LaserBatch.time_base) };
+      LaserBatch.instances.push_back(instance);
+    }
   }
-  else
+  LaserBatch.count = LaserBatch.instances.size();
+  if (LaserBatch.count > LaserBatch.capacity ||
+      !uploadrecords(&DynamicBuffer, LaserBatch.RecordBuffer, LaserBatch.instances.data(), LaserBatch.count*sizeof(LaserInstance)))
   {
-    return false;
+    LaserBatch.count = 0;
+    LaserBatch.version = game.lasers_version - 1;
   }
 }
 
-VAO* checkcollisionbtwlaserbrick(VAO* Laser)
+/* Draw every brick with a single instanced call, placed by the shader */
+void drawbricks (const glm::mat4& VP)
 {
-  for (int j = 0; j < bricks.size(); j++)
+  if (BrickBatch.count == 0)
   {
-    if ((bricks[j]->active == true) &&
-        (bricks[j]->x > Laser->x -1.7) && (bricks[j]->x < Laser->x + 1) &&
-        (bricks[j]->y > Laser->y -1.7) && (bricks[j]->y < Laser->y + 1)
-       )
-    {
-      bool one = checkintersection(Laser->x,Laser->y,
-                                  Laser->x + 1*cos(Laser->inclination*M_PI/180.0f),
-                                  Laser->y + 1*sin(Laser->inclination*M_PI/180.0f),
-                                  bricks[j]->x,bricks[j]->y,bricks[j]->x ,bricks[j]->y + 0.7);
-      bool two = checkintersection(Laser->x,Laser->y,
-                                  Laser->x + 1*cos(Laser->inclination*M_PI/180.0f),
-                                  Laser->y + 1*sin(Laser->inclination*M_PI/180.0f),
-                                  bricks[j]->x,bricks[j]->y,bricks[j]->x + 0.7 ,bricks[j]->y);
-      bool three = checkintersection(Laser->x,Laser->y,
-                                  Laser->x + 1*cos(Laser->inclination*M_PI/180.0f),
-                                  Laser->y + 1*sin(Laser->inclination*M_PI/180.0f),
-                                  bricks[j]->x + 0.7,bricks[j]->y+0.7,bricks[j]->x ,bricks[j]->y + 0.7);
-      bool four = checkintersection(Laser->x,Laser->y,
-                                  Laser->x + 1*cos(Laser->inclination*M_PI/180.0f),
-                                  Laser->y + 1*sin(Laser->inclination*M_PI/180.0f),
-                                  bricks[j]->x+0.7,bricks[j]->y+0.7,bricks[j]->x + 0.7 ,bricks[j]->y);
-
-      if (one || two || three || four)
-      {
-        Laser->active = false;
-        bricks[j]->active = false;
-        if (bricks[j]->color == 1)
-        {
-          redbrickshit++;
-          score -= 5;
-          cout << "score " << score << endl;
-        }
-        else if (bricks[j]->color == 2)
-        {
-          greenbrickshit++;
-          score -= 5;
-          cout << "score " << score << endl;
-        }
-        else if (bricks[j]->color == 0)
-        {
-          score += 50;
-          cout << "score " << score << endl;
-        }
-        if (redbrickshit > 5 || greenbrickshit > 5)
-        {
-          gameover = true;
-        }
-        break;
-      }
-
-
-    }
+    return;
   }
 
-  return Laser;
+  useprogram (BrickBatch.ProgramID);
+  glUniformMatrix4fv(BrickBatch.VPID, 1, GL_FALSE, &VP[0][0]);
+  glUniform1f(BrickBatch.FallID, falldistance(&game) - BrickBatch.fall_base);
+
+  setpolygonmode (brick->geometry->FillMode);
+  bindvertexarray (brick->geometry->VertexArrayID);
+  glDrawArraysInstanced(brick->geometry->PrimitiveMode, 0, brick->geometry->NumVertices, BrickBatch.count);
+  GLState.draws++;
 }
 
-VAO* checkcollisionwithmirrors(VAO* Laser)
+/* Draw every active laser with a single instanced call, moved by the shader */
+void drawlasers (const glm::mat4& VP)
 {
-  float x1 = Laser->x;
-  float y1 = Laser->y;
-  float x2 = Laser->x + 1*cos(Laser->inclination*M_PI/180.0f);
-  float y2 = Laser->y + 1*sin(Laser->inclination*M_PI/180.0f);
-
-  int j = 0;
-  for (j = 0; j < mirrors.size(); j++)
+  if (LaserBatch.count == 0)
   {
-    float x = mirrors[j]->x;
-    float y = mirrors[j]->y;
-
-    float x3 = x + 1*cos(mirrors[j]->angle*M_PI/180.0f);
-    float y3 = y + 1*sin(mirrors[j]->angle*M_PI/180.0f);
-
-    float x4 = x - 1*cos(mirrors[j]->angle*M_PI/180.0f);
-    float y4 = y - 1*sin(mirrors[j]->angle*M_PI/180.0f);
-
-    bool statement = ( (
-                          ((y3-y1)*(x2-x1)-(y2-y1)*(x3-x1))*
-                          ((y4-y1)*(x2-x1)-(y2-y1)*(x4-x1)) < 0
-                       ) &&
-                       (
-                         ((y1-y3)*(x4-x3)-(y4-y3)*(x1-x3))*
-                         ((y2-y3)*(x4-x3)-(y4-y3)*(x2-x3)) < 0
-                       )
-                     );
-
-
-
-    if (statement && Laser->reflection == false)
-    {//cout << "one" <<endl;
-
-      Laser->reflection = true;
-
-      Laser->x = ((x1*y2-y1*x2)*(x3-x4)-(x1-x2)*(x3*y4-y3*x4))/((x1-x2)*(y3-y4)-(y1-y2)*(x3-x4));
-
-      Laser->y = ((x1*y2-y1*x2)*(y3-y4)-(y1-y2)*(x3*y4-y3*x4))/((x1-x2)*(y3-y4)-(y1-y2)*(x3-x4));
-
-      Laser->inclination = 2*mirrors[j]->angle - Laser->inclination;
-      //playwav("reflection.wav");
-      return Laser;
-    }
-
+    return;
   }
 
-  return Laser;
+  useprogram (LaserBatch.ProgramID);
+  glUniformMatrix4fv(LaserBatch.VPID, 1, GL_FALSE, &VP[0][0]);
+  glUniform1f(LaserBatch.TimeID, game.sim_time - LaserBatch.time_base);
+
+  setpolygonmode (laser->geometry->FillMode);
+  bindvertexarray (laser->geometry->VertexArrayID);
+  glDrawArraysInstanced(laser->geometry->PrimitiveMode, 0, laser->geometry->NumVertices, LaserBatch.count);
+  GLState.draws++;
 }
 
+void createcannon ()
+{
+  cannon_gun = createrectangle( 0,-0.2,0, 2,-0.2,0, 2, 0.2,0, 0, 0.2,0,
+                                0.8,0.3,1, 0.8,0.3,1, 0.8,0.3,1, 0.8,0.3,1, 0,0,0 );
 
+}
 
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw ()
+// Creates the rectangle object used in this sample code
+void createbaskets ()
 {
+  bask1 = createrectangle(-1.5,-0.5,0, 1.5,-0.5,0, 1.5, 1,0, -1.5,1,0,
+                          1,0,0, 1,0,0, 1,0,0, 1,0,0, 0,0,0 );
+  bask2 = createrectangle(-1.5,-0.5,0, 1.5,-0.5,0, 1.5, 1,0, -1.5,1,0,
+                          0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,0,0 );
+}
 
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
+/* Rebuild VP when the visible bounds have changed since the last frame */
+void updatecamera ()
+{
+  if (Camera.version != 0 && Camera.bnx == game.bnx && Camera.bx == game.bx &&
+      Camera.bny == game.bny && Camera.by == game.by)
+  {
+    return;
+  }
+  Camera.bnx = game.bnx;
+  Camera.bx = game.bx;
+  Camera.bny = game.bny;
+  Camera.by = game.by;
 
   // Eye - Location of camera. Don't change unless you are sure!!
   glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
@@ -1320,299 +1248,108 @@ void draw ()
   // Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
   //  Don't change unless you are sure!!
   Matrices.view = glm::lookAt(eye, target, up); // Fixed camera for 2D (ortho) in XY plane
+  Matrices.projection = glm::ortho(game.bnx, game.bx, game.bny, game.by, 0.1f, 500.0f);
 
-  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-  //  Don't change unless you are sure!!
-  glm::mat4 VP = Matrices.projection * Matrices.view;
-
-  // Send our transformation to the currently bound shader, in the "MVP" uniform
-  // For each model you render, since the MVP will be different (at least the M part)
-  //  Don't change unless you are sure!!
-  glm::mat4 MVP;	// MVP = Projection * View * Model
-
-  // Load identity to model matrix
-
-  if (!gameover)
-  {
-    if (mouse_right_drag)
-    {
-      if (xpos < mxpos)
-      {
-        if (  bnx-(mxpos-xpos)>= -10 )
-        {
-          bnx = bnx-(mxpos-xpos);
-          bx = bx-(mxpos-xpos);
-          Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
-        }
-
-      }
-      else if (xpos > mxpos)
-      {
-        if (bx + (xpos-mxpos) <= 10)
-        {
-          bnx = bnx + (xpos-mxpos);
-          bx = bx + (xpos-mxpos);
-          Matrices.projection = glm::ortho(bnx, bx, bny, by, 0.1f, 500.0f);
-        }
-
-      }
-    }
-
-    if ((sqrt((cannon_gun->x-xpos)*(cannon_gun->x-xpos)
-        +(cannon_gun->y-ypos)*(cannon_gun->y-ypos)) < 1) && mouse_left_drag)
-    {
-        cannon_gun->drag = true;
-        cannon_gun->y = ypos > 8 ? 8 : (ypos < -5.5 ? -5.5 : ypos);
-        for (int j = 0 ; j < circle.size() ; j++)
-        {
-          circle[j]->drag = true;
-          circle[j]->y = ypos > 8 ? 8 : (ypos < -5.5 ? -5.5 : ypos);
-        }
-        for (int j = 0 ; j < smcircle.size() ; j++)
-        {
-          smcircle[j]->drag = true;
-          smcircle[j]->y = ypos > 8 ? 8 : (ypos < -5.5 ? -5.5 : ypos);
-        }
-    }
-
-    if (bask1->active == false && bask2->active == false)
-    {
-      if (mouse_left_drag)
-      {
-        if (bask1->drag == true)
-        {
-          drag_basket = 1;
-        }
-        else if (bask2->drag == true)
-        {
-          drag_basket = 2;
-        }
-      }
-      else
-      {
-        if (sqrt((bask1->x-xpos)*(bask1->x-xpos)+(bask1->y-ypos)*(bask1->y-ypos)) >
-        sqrt((bask2->x-xpos)*(bask2->x-xpos)+(bask2->y-ypos)*(bask2->y-ypos)))
-        {
-          drag_basket = 2;
-        }
-        else
-        {
-          drag_basket = 1;
-        }
-
-      }
-
-    }
-
-    if ((mouse_left_drag)&&(xpos < bask1->x+1.5)&&(bask1->active || (!bask1->active && drag_basket == 1))&&
-        (xpos > bask1->x-1.5)&&(ypos < bask1->y+0.5)&&(ypos > bask1->y - 0.5))
-    {
-
-        bask1->drag = true;
-        bask1->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
-        for ( int j = 0 ;j < baskcircle1.size() ; j++)
-        {
-          baskcircle1[j]->drag = true;
-          baskcircle1[j]->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
-        }
-        for ( int j = 0 ;j < b1circle.size() ; j++)
-        {
-          b1circle[j]->drag = true;
-          b1circle[j]->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
-        }
-
-    }
-
-    if ((mouse_left_drag)&&(xpos < bask2->x+1.5)&&(bask2->active || (!bask2->active && drag_basket == 2))&&
-        (xpos > bask2->x-1.5)&&(ypos < bask2->y+0.5)&&(ypos > bask2->y - 0.5))
-    {
-
-        bask2->drag = true;
-        bask2->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
-        for ( int j = 0 ;j < baskcircle2.size() ; j++)
-        {
-          baskcircle2[j]->drag = true;
-          baskcircle2[j]->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
-        }
-        for ( int j = 0 ;j < b2circle.size() ; j++)
-        {
-          b2circle[j]->drag = true;
-          b2circle[j]->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
-        }
-    }
-
-
-    for ( int j = 0 ; j < circle.size()  ; j++)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatesegment = glm::translate (glm::vec3(circle[j]->x, circle[j]->y, circle[j]->z)); // glTranslatef
-      glm::mat4 rotatesegment = glm::rotate((float)(M_PI+j*10*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-      Matrices.model *= (translatesegment*rotatesegment);
-      MVP = VP * Matrices.model; // MVP = p * V * M
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(circle[j]);
-    }
-
-    for ( int j = 0 ; j < smcircle.size()  ; j++)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatesegment = glm::translate (glm::vec3(smcircle[j]->x, smcircle[j]->y, smcircle[j]->z)); // glTranslatef
-      glm::mat4 rotatesegment = glm::rotate((float)(M_PI+j*10*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-      Matrices.model *= (translatesegment*rotatesegment);
-      MVP = VP * Matrices.model; // MVP = p * V * M
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(smcircle[j]);
-    }
-
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translatecannon_gun = glm::translate (glm::vec3( cannon_gun->x, cannon_gun->y, cannon_gun->z));        // glTranslatef
-    glm::mat4 transformcannon_gun = glm::rotate((float)(cannon_gun_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-    Matrices.model *= (translatecannon_gun*transformcannon_gun);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(cannon_gun);
-
-
-    for (int j = 0 ; j < lasers.size();j++)
-    {
-      if (lasers[j]->active == true)
-      {
-
-        Matrices.model = glm::mat4(1.0f);
-        glm::mat4 translatelaser = glm::translate (glm::vec3(lasers[j]->x, lasers[j]->y, lasers[j]->z)); // glTranslatef
-        glm::mat4 rotatelaser = glm::rotate((float)(lasers[j]->inclination*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-        Matrices.model *= translatelaser * rotatelaser;
-        MVP = VP * Matrices.model; // MVP = p * V * M
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(lasers[j]);
-        if (checkcollisionwithwalls(lasers[j]))
-        {
-          lasers[j]->active = false;
-          lasers[j]->reflection = false;
-        }
-
-        lasers[j] = checkcollisionwithmirrors(lasers[j]);
-        lasers[j] = checkcollisionbtwlaserbrick(lasers[j]);
-
-      }
-
-    }
-
-
-
-    for (int j = 0 ; j < mirrors.size(); j++)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatemirror = glm::translate (glm::vec3(mirrors[j]->x, mirrors[j]->y, mirrors[j]->z));        // glTranslatef
-      glm::mat4 rotatemirror = glm::rotate((float)(mirrors[j]->angle*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-      Matrices.model *= (translatemirror*rotatemirror);
-      MVP = VP * Matrices.model;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(mirrors[j]);
+  Camera.VP = Matrices.projection * Matrices.view;
+  Camera.version++;
+}
 
-    }
+/* Build the hierarchy once the meshes exist. The cannon and each basket are one
+   node whose children move with it */
+void createscene ()
+{
+  scene = createnode(NULL, NULL);
 
+  cannon_node = createnode(NULL, scene);
+  createnode(circle, cannon_node);
+  createnode(smcircle, cannon_node);
+  cannon_gun_node = createnode(cannon_gun, cannon_node);
 
+  // Basket rims and bases are circles tilted back into ellipses
+  glm::mat4 tiltcircle = glm::rotate((float)(80*M_PI/180.0f), glm::vec3(-1,0,0));  // rotate about vector (-1,0,0)
 
+  bask1_node = createnode(NULL, scene);
+  createnode(baskcircle1, bask1_node, tiltcircle);
+  createnode(b1circle, bask1_node, tiltcircle);
+  createnode(bask1, bask1_node);
 
+  bask2_node = createnode(NULL, scene);
+  createnode(baskcircle2, bask2_node, tiltcircle);
+  createnode(b2circle, bask2_node, tiltcircle);
+  createnode(bask2, bask2_node);
 
-    for ( int j = 0 ; j < baskcircle1.size()  ; j++)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatesegment = glm::translate (glm::vec3(baskcircle1[j]->x, baskcircle1[j]->y, baskcircle1[j]->z)); // glTranslatef
-      glm::mat4 rotatesegment = glm::rotate((float)(M_PI+j*10*M_PI/180.0f), glm::vec3(0,0,1));
-        glm::mat4 rotatesegment2 = glm::rotate((float)(80*M_PI/180.0f), glm::vec3(-1,0,0));  // rotate about vector (1,0,0)
-      Matrices.model *= (translatesegment*rotatesegment2*rotatesegment);
-      MVP = VP * Matrices.model; // MVP = p * V * M
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(baskcircle1[j]);
-    }
+  createnode(line, scene);
 
-    for ( int j = 0 ; j < baskcircle2.size()  ; j++)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatesegment = glm::translate (glm::vec3(baskcircle2[j]->x, baskcircle2[j]->y, baskcircle2[j]->z)); // glTranslatef
-      glm::mat4 rotatesegment = glm::rotate((float)(M_PI+j*10*M_PI/180.0f), glm::vec3(0,0,1));
-        glm::mat4 rotatesegment2 = glm::rotate((float)(80*M_PI/180.0f), glm::vec3(-1,0,0));  // rotate about vector (1,0,0)
-      Matrices.model *= (translatesegment*rotatesegment2*rotatesegment);
-      MVP = VP * Matrices.model; // MVP = p * V * M
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(baskcircle2[j]);
-    }
+  // The mirrors never move, so their matrices are built once here
+  for (int j = 0 ; j < game.mirrors.size() ; j++)
+  {
+    SceneNode* node = createnode(mirror, scene);
+    placenode(node, game.mirrors[j].x, game.mirrors[j].y, game.mirrors[j].angle);
+  }
+}
 
+/* Render the scene with openGL */
+/* Only reads the game state, all updates happen in step() */
+void draw ()
+{
 
+  // use the loaded shader program
+  // Don't change unless you know what you are doing
+  useprogram (programID);
 
-    for ( int j = 0 ; j < b1circle.size()  ; j++)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatesegment = glm::translate (glm::vec3(b1circle[j]->x, b1circle[j]->y, b1circle[j]->z)); // glTranslatef
-      glm::mat4 rotatesegment = glm::rotate((float)(M_PI+j*10*M_PI/180.0f), glm::vec3(0,0,1));
-        glm::mat4 rotatesegment2 = glm::rotate((float)(80*M_PI/180.0f), glm::vec3(-1,0,0));  // rotate about vector (1,0,0)
-      Matrices.model *= (translatesegment*rotatesegment2*rotatesegment);
-      MVP = VP * Matrices.model; // MVP = p * V * M
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(b1circle[j]);
-    }
+  updatecamera();
+  const glm::mat4& VP = Camera.VP;
 
-    for ( int j = 0 ; j < b2circle.size()  ; j++)
-    {
-      Matrices.model = glm::mat4(1.0f);
-      glm::mat4 translatesegment = glm::translate (glm::vec3(b2circle[j]->x, b2circle[j]->y, b2circle[j]->z)); // glTranslatef
-      glm::mat4 rotatesegment = glm::rotate((float)(M_PI+j*10*M_PI/180.0f), glm::vec3(0,0,1));
-      glm::mat4 rotatesegment2 = glm::rotate((float)(80*M_PI/180.0f), glm::vec3(-1,0,0));  // rotate about vector (1,0,0)
-      Matrices.model *= (translatesegment*rotatesegment2*rotatesegment);
-      MVP = VP * Matrices.model; // MVP = p * V * M
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      draw3DObject(b2circle[j]);
-    }
+  // The cannon and the baskets follow the game, only moved nodes are rebuilt
+  placenode(cannon_node, game.cannon.x, game.cannon.y, 0);
+  placenode(cannon_gun_node, 0, 0, game.cannon.rotation);
+  placenode(bask1_node, game.bask1.x, game.bask1.y, 0);
+  placenode(bask2_node, game.bask2.x, game.bask2.y, 0);
+  updatescene(scene, glm::mat4(1.0f), false);
 
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translateline = glm::translate (glm::vec3(line->x, line->y, line->z));        // glTranslatef
-    Matrices.model *= (translateline);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(line);
+  if (!game.gameover)
+  {
+    drawscene(scene);
 
+    flushdrawlist(false);
 
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translatebask1 = glm::translate (glm::vec3(bask1->x, bask1->y, bask1->z));        // glTranslatef
-    Matrices.model *= (translatebask1);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(bask1);
+    // Records only go up when something spawned, turned or went
+    beginstreambuffer(&DynamicBuffer);
+    updatelaserrecords();
+    updatebrickrecords();
+    endstreambuffer(&DynamicBuffer);
 
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translatebask2 = glm::translate (glm::vec3(bask2->x, bask2->y, bask2->z));        // glTranslatef
-    Matrices.model *= (translatebask2);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(bask2);
+    // Lasers go just over the cannon and under the mirrors, bricks over everything
+    drawlasers(VP * glm::translate(glm::vec3(0, 0, cannon_gun_node->layer + layer_step / 2)));
+    drawbricks(VP * glm::translate(glm::vec3(0, 0, layer_count * layer_step)));
 
-    checkcollisionbtwbaskets();
+    flushdrawlist(true);
 
-    for (int j = 0; j < bricks.size(); j++)
-    {
-      if (bricks[j]->active == true )
-      {
-        Matrices.model = glm::mat4(1.0f);
-        glm::mat4 translatebrick = glm::translate (glm::vec3(bricks[j]->x, bricks[j]->y, bricks[j]->z));        // glTranslatef
-        Matrices.model *= (translatebrick);
-        MVP = VP * Matrices.model;
-        glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        draw3DObject(bricks[j]);
-
-        bricks[j] = checkcollisionbtwbrickbasket(bricks[j]);
-      }
+  }
 
-    }
+}
 
+/* React to what the game reported since the last call */
+void handleevents ()
+{
+  if (game.events & GAME_EVENT_SCORE)
+  {
+    cout << "score " << game.score << endl;
   }
-
+  if (game.events & GAME_EVENT_LASER)
+  {
+    playsound(SOUND_LASER);
+  }
+  if (game.events & GAME_EVENT_REFLECTION)
+  {
+    //playsound(SOUND_REFLECTION);
+  }
+  game.events = 0;
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
-/* Nothing to Edit here */
-GLFWwindow* initGLFW (int width, int height)
+/* A hidden window only provides the context, for benchmark runs without a display */
+GLFWwindow* initGLFW (int width, int height, bool hidden = false)
 {
     GLFWwindow* window; // window desciptor/handle
 
@@ -1625,6 +1362,7 @@ GLFWwindow* initGLFW (int width, int height)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, hidden ? GL_FALSE : GL_TRUE);
 
     window = glfwCreateWindow(width, height, "Laser Shooting Game", NULL, NULL);
 
@@ -1635,7 +1373,7 @@ GLFWwindow* initGLFW (int width, int height)
 
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-    glfwSwapInterval( 1 );
+    glfwSwapInterval( hidden ? 0 : 1 );
 
     /* --- register callbacks with GLFW --- */
 
@@ -1673,21 +1411,45 @@ void initGL (GLFWwindow* window, int width, int height)
 	 // Generate the VAO, VBOs, vertices data & copy into the array buffer
 	createbaskets ();
   createcannon();
-  createbricks();
   createcircle();
   createbaskcircle();
   createsmallcircle();
   createcirclebottom2();
   createcirclebottom1();
-  createlasers();
+  createlaser();
   createline();
-  createmirrors();
+  createmirror();
+  createbrickquad();
+  createscene();
 
 	// Create and compile our GLSL program from the shaders
 	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
 	// Get a handle for our "MVP" uniform
 	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
 
+	// Circle quads, cut out per pixel
+	CircleBatch.ProgramID = LoadShaders( "Circle_GL.vert", "Circle_GL.frag" );
+	CircleBatch.MVPID = glGetUniformLocation(CircleBatch.ProgramID, "MVP");
+	CircleBatch.RadiusID = glGetUniformLocation(CircleBatch.ProgramID, "radius");
+
+	// Instanced program for the falling bricks, takes VP only
+	BrickBatch.ProgramID = LoadShaders( "Brick_GL.vert", "Sample_GL.frag" );
+	BrickBatch.VPID = glGetUniformLocation(BrickBatch.ProgramID, "VP");
+	BrickBatch.FallID = glGetUniformLocation(BrickBatch.ProgramID, "fall");
+	useprogram (BrickBatch.ProgramID);
+	glUniform1f(glGetUniformLocation(BrickBatch.ProgramID, "spawnY"), brick_spawn_y);
+
+	// Instanced program for the lasers, also takes VP only
+	LaserBatch.ProgramID = LoadShaders( "Laser_GL.vert", "Sample_GL.frag" );
+	LaserBatch.VPID = glGetUniformLocation(LaserBatch.ProgramID, "VP");
+	LaserBatch.TimeID = glGetUniformLocation(LaserBatch.ProgramID, "time");
+	useprogram (LaserBatch.ProgramID);
+	glUniform1f(glGetUniformLocation(LaserBatch.ProgramID, "speed"), laser_step / game_timestep);
+
+	// Room to replace every record in one frame
+	createstreambuffer(&DynamicBuffer, game.bricks.x.size()*sizeof(BrickInstance) +
+	                                   game.lasers.size()*sizeof(LaserInstance));
+
 
 	reshapeWindow (window, width, height);
 
@@ -1698,108 +1460,298 @@ void initGL (GLFWwindow* window, int width, int height)
 	glEnable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
 
+	// Only the circle edges blend, see flushdrawlist
+	glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
     cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
     cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
     cout << "VERSION: " << glGetString(GL_VERSION) << endl;
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Render "frames" frames of a scripted game into an off-screen framebuffer
+   and report the frame time distribution and the draw calls. Each frame is
+   timed up to glFinish, so software renderers are measured in full */
+void runbenchmark (int width, int height, int frames)
+{
+  GLuint framebuffer, colorbuffer, depthbuffer;
+  glGenFramebuffers (1, &framebuffer);
+  glBindFramebuffer (GL_FRAMEBUFFER, framebuffer);
+
+  glGenRenderbuffers (1, &colorbuffer);
+  glBindRenderbuffer (GL_RENDERBUFFER, colorbuffer);
+  glRenderbufferStorage (GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorbuffer);
+
+  glGenRenderbuffers (1, &depthbuffer);
+  glBindRenderbuffer (GL_RENDERBUFFER, depthbuffer);
+  glRenderbufferStorage (GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+  glFramebufferRenderbuffer (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthbuffer);
+
+  if (glCheckFramebufferStatus (GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+  {
+    cout << "benchmark framebuffer incomplete" << endl;
+    return;
+  }
+  glViewport (0, 0, width, height);
+
+  vector<double> times;
+  // Count only the timed frames, not the setup in initGL
+  GLState.draws = GLState.calls = GLState.skipped = 0;
+  Game first = game; // the seeded game or a --snapshot scene
+  for (int frame = 0 ; frame < frames ; frame++)
+  {
+    // Script : sweep the cannon, fire whenever it is ready and restart on game over
+    if (game.gameover)
+    {
+      game = first;
+      rebuildrecords();
+    }
+    gamekey(&game, (frame / 120) % 2 ? GAME_KEY_TILT_UP : GAME_KEY_TILT_DOWN, GAME_REPEAT);
+    gamekey(&game, GAME_KEY_FIRE, GAME_PRESS);
+    for (int k = 0 ; k < 2 ; k++)
+    {
+      stepgame(&game);
+    }
+    game.events = 0;
+
+    double start = glfwGetTime();
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    draw();
+    glFinish();
+    times.push_back(glfwGetTime() - start);
+  }
+
+  if (times.empty())
+  {
+    return;
+  }
+
+  double total = 0;
+  for (int i = 0 ; i < times.size() ; i++)
+  {
+    total += times[i];
+  }
+  sort(times.begin(), times.end());
+  int n = times.size();
+
+  cout << "frames " << n << endl;
+  cout << "frame ms mean " << 1000*total/n
+       << " p50 " << 1000*times[n*50/100]
+       << " p95 " << 1000*times[n*95/100]
+       << " p99 " << 1000*times[n*99/100] << endl;
+  cout << "draw calls per frame " << (double)GLState.draws/n
+       << ", gl state calls " << (double)GLState.calls/n
+       << ", redundant skipped " << (double)GLState.skipped/n << endl;
+
+  glBindFramebuffer (GL_FRAMEBUFFER, 0);
+  glDeleteRenderbuffers (1, &depthbuffer);
+  glDeleteRenderbuffers (1, &colorbuffer);
+  glDeleteFramebuffers (1, &framebuffer);
+}
+
 int main (int argc, char** argv)
 {
 	int width = 600;
 	int height = 600;
 
-    GLFWwindow* window = initGLFW(width, height);
+    // A fixed --seed replays the same bricks, otherwise every run differs
+    uint64_t seed = time(NULL);
+    bool seeded = false;
+    int benchmark_frames = 0;
+    const char* replay_path = NULL;
+    bool from_snapshot = false;
+    bool fast = false;
+    for (int i = 1 ; i < argc ; i++)
+    {
+      if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      {
+        seed = strtoull(argv[++i], NULL, 10);
+        seeded = true;
+      }
+      else if (!strcmp(argv[i], "--render-stats"))
+      {
+        render_stats = true;
+      }
+      else if (!strcmp(argv[i], "--benchmark") && i + 1 < argc)
+      {
+        benchmark_frames = atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--timescale") && i + 1 < argc)
+      {
+        time_scale = atof(argv[++i]);
+        if (time_scale <= 0)
+        {
+          cout << "--timescale must be above 0" << endl;
+          return 1;
+        }
+      }
+      else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+      {
+        record_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+      {
+        replay_path = argv[++i];
+      }
+      else if (!strcmp(argv[i], "--fast"))
+      {
+        fast = true;
+      }
+      else if (!strcmp(argv[i], "--rewind") && i + 1 < argc)
+      {
+        rewind_seconds = atof(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "--snapshot") && i + 1 < argc)
+      {
+        snapshot_path = argv[++i];
+        from_snapshot = true;
+      }
+    }
 
-	  initGL (window, width, height);
+    // A replay plays the game of the log, from its seed
+    if (replay_path != NULL)
+    {
+      if (!loadinputlog(&replay_log, replay_path))
+      {
+        cout << "Unable to read input log " << replay_path << endl;
+        return 1;
+      }
+      seed = replay_log.seed;
+      seeded = true;
+      replaying = true;
+    }
 
-    double last_brick_update_time = glfwGetTime(),
-           last_laser_update_time = glfwGetTime(),
-           last_brick_creation_time = glfwGetTime(),
-           current_time;
+    // Headless replay at full speed, for repros and regression timing
+    if (replaying && fast)
+    {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      runreplay(&game, replay_log);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      cout << "replayed " << game.tick << " ticks in " << seconds << " s, score " << game.score
+           << (game.gameover ? " (game over)" : "") << endl;
+      return 0;
+    }
+    // Benchmarks compare runs, so they play the same game unless told otherwise
+    if (benchmark_frames > 0 && !seeded)
+    {
+      seed = 1;
+    }
+    cout << "seed " << seed << endl;
 
+    initgame(&game, seed);
+    game.recording = record_path != NULL && !replaying;
 
+    // Carry on from a saved game, a replay always starts from its seed
+    if (from_snapshot && !replaying)
+    {
+      if (!loadsnapshot(&game, snapshot_path))
+      {
+        cout << "Unable to read snapshot " << snapshot_path << endl;
+        return 1;
+      }
+      game.recording = false;
+    }
 
+    GLFWwindow* window = initGLFW(width, height, benchmark_frames > 0);
 
-    /* Draw in loop */
-    while (!glfwWindowShouldClose(window)) {
+	  initGL (window, width, height);
 
-        // OpenGL Draw commands
-        // clear the color and depth in the frame buffer
-        glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        draw();
-        //ao_play(device, buffer, BUF_SIZE);
+    if (benchmark_frames > 0)
+    {
+      runbenchmark(width, height, benchmark_frames);
+      quit(window);
+      return 0;
+    }
 
-        if (gameover)
-        {
+    initaudio();
+    initrewind(&Rewind, rewind_seconds / game_timestep);
 
-          cout << "Game Over final score " << score << endl;
-          const char* audio = "gameover.wav";
-          playaudio((void*) audio);
-          quit(window);
-          return 0;
+    // A faster game needs proportionally more steps per frame, or the backlog
+    // cap would silently hold it to about max_substeps steps a frame
+    int frame_substeps = max_substeps * max(1.0, ceil(time_scale));
 
-        }
+    double previous_time = glfwGetTime(), current_time, accumulator = 0;
+    double stats_time = previous_time;
+    int stats_frames = 0;
 
-        // Swap Frame Buffer in double buffering
-        glfwSwapBuffers(window);
+    /* Draw in loop */
+    while (!glfwWindowShouldClose(window)) {
 
         // Poll for Keyboard and mouse events
         glfwPollEvents();
 
-        // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
-
+        // Run as many fixed simulation steps as the elapsed game time covers,
+        // dropping the backlog if we fall more than frame_substeps behind.
+        // The game clock stands still while paused
         current_time = glfwGetTime(); // Time in seconds
-
-        if (current_time > latest_cannonfire_time + 1)
+        if (!paused)
         {
-          cannon_active = true;
+          accumulator += (current_time - previous_time) * time_scale;
         }
+        previous_time = current_time;
 
-        if ((current_time - last_laser_update_time) >= 0.01)
+        // Scrub back through the rewind buffer twice as fast as the game runs,
+        // play resumes from wherever R is released
+        if (rewinding)
         {
-          // atleast 0.5s elapsed since last frame
-            // do something every 0.5 seconds ..
-            for (int j = 0; j < lasers.size(); j++)
-            {
-              if (lasers[j]->active == true)
-              {
-                lasers[j]->x += 0.5*cos(lasers[j]->inclination*M_PI/180.0f);
-                lasers[j]->y += 0.5*sin(lasers[j]->inclination*M_PI/180.0f);
-                if (lasers[j]->reflection == true)
-                {
-                  lasers[j]->reflection = false;
-                }
-              }
-            }
-
-            last_laser_update_time = current_time;
+          int ticks = accumulator / game_timestep;
+          accumulator -= ticks * game_timestep;
+          if (ticks > 0 && rewindgame(&Rewind, &game, 2 * ticks))
+          {
+            rebuildrecords();
+          }
         }
 
-        if ((current_time - last_brick_update_time) >= brick_falling_frequency)
+        int substeps = 0;
+        while (accumulator >= game_timestep && !game.gameover && !rewinding)
         {
-          // atleast 0.5s elapsed since last frame
-            // do something every 0.5 seconds ..
-            for (int j =0 ; j<bricks.size() ; j++)
-            {
+          if (replaying && !replayinputs(&game, replay_log, &replay_next))
+          {
+            cout << "Replay finished at tick " << game.tick << ", score " << game.score << endl;
+            quit(window);
+            return 0;
+          }
+          stepgame(&game);
+          recordrewind(&Rewind, &game);
+          accumulator -= game_timestep;
+          if (++substeps == frame_substeps)
+          {
+            accumulator = 0;
+          }
+        }
 
-              if (bricks[j]->active == true)
-              {
-                bricks[j]->y -= 0.25;
-              }
+        handleevents();
 
-            }
+        if (game.gameover)
+        {
+
+          cout << "Game Over final score " << game.score << endl;
+          playsound(SOUND_GAMEOVER);
+          waitaudio();
+          quit(window);
+          return 0;
 
-            last_brick_update_time = current_time;
         }
 
-        if ((current_time - last_brick_creation_time) >= 5)
+        // OpenGL Draw commands
+        // clear the color and depth in the frame buffer
+        glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw();
+
+        // Swap Frame Buffer in double buffering
+        glfwSwapBuffers(window);
+
+        stats_frames++;
+        if (render_stats && current_time - stats_time >= 1)
         {
-          createbricks();
-          last_brick_creation_time = current_time;
+          cout << "gl state calls per frame " << GLState.calls / stats_frames
+               << ", redundant skipped " << GLState.skipped / stats_frames << endl;
+          GLState.calls = GLState.skipped = 0;
+          stats_frames = 0;
+          stats_time = current_time;
         }
 
-
     }
 
 
@@ -0,0 +1,302 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <atomic>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <ao/ao.h>
+
+#include "audio.h"
+
+using namespace std;
+
+/* Every sound is converted to the device format when it is loaded */
+static const int MIX_RATE = 44100;
+static const int MIX_CHANNELS = 2;
+static const int MIX_FRAMES = 256; // frames mixed per ao_play call, ~6ms
+static const int MAX_VOICES = 16;
+static const int QUEUE_SIZE = 64; // power of two
+
+static const char* sound_files[SOUND_COUNT] = {
+    "laser.wav",
+    "reflection.wav",
+    "game_over.wav",
+    "gameover.wav",
+};
+
+struct Voice {
+    int sound;
+    int position; // next frame to mix
+};
+
+struct AudioEngine {
+    ao_device* device;
+    pthread_t thread;
+    bool running;
+
+    vector<int16_t> samples[SOUND_COUNT]; // interleaved stereo at MIX_RATE
+
+    // Single-producer single-consumer ring of sound ids, written by the
+    // game thread and drained by the mixer
+    int queue[QUEUE_SIZE];
+    atomic<unsigned> head; // next slot the mixer reads
+    atomic<unsigned> tail; // next slot the game writes
+
+    Voice voices[MAX_VOICES];
+    atomic<int> playing; // voices still sounding, published by the mixer
+    atomic<bool> quit;
+} Audio;
+
+static int readle (const unsigned char* p, int bytes)
+{
+  int value = 0;
+  for (int i = bytes - 1 ; i >= 0 ; i--)
+  {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+/* Decode a PCM WAV file into interleaved 16-bit stereo at MIX_RATE */
+static bool loadwav (const char* filepath, vector<int16_t>& out)
+{
+  ifstream file(filepath, ios::binary | ios::in);
+  if (!file.is_open())
+  {
+    cout << "Unable to open " << filepath << endl;
+    return false;
+  }
+  vector<unsigned char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+  if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) || memcmp(&data[8], "WAVE", 4))
+  {
+    cout << filepath << " is not a WAV file" << endl;
+    return false;
+  }
+
+  int channels = 0, frequency = 0, bitsPerSample = 0;
+  const unsigned char* pcm = NULL;
+  int pcmBytes = 0;
+
+  // Walk the chunks, only "fmt " and "data" matter
+  size_t offset = 12;
+  while (offset + 8 <= data.size())
+  {
+    int chunkSize = readle(&data[offset + 4], 4);
+    const unsigned char* chunk = &data[offset + 8];
+    if (offset + 8 + chunkSize > data.size())
+    {
+      chunkSize = data.size() - offset - 8;
+    }
+
+    if (!memcmp(&data[offset], "fmt ", 4) && chunkSize >= 16)
+    {
+      channels = readle(chunk + 2, 2);
+      frequency = readle(chunk + 4, 4);
+      bitsPerSample = readle(chunk + 14, 2);
+    }
+    else if (!memcmp(&data[offset], "data", 4))
+    {
+      pcm = chunk;
+      pcmBytes = chunkSize;
+    }
+
+    offset += 8 + chunkSize + (chunkSize & 1);
+  }
+
+  if (pcm == NULL || channels < 1 || frequency <= 0 || (bitsPerSample != 8 && bitsPerSample != 16))
+  {
+    cout << filepath << " is not 8 or 16 bit PCM" << endl;
+    return false;
+  }
+
+  int frameBytes = channels * bitsPerSample / 8;
+  int frames = pcmBytes / frameBytes;
+
+  // Source frames as stereo floats, mono is duplicated to both sides
+  vector<float> source(2 * frames);
+  for (int i = 0 ; i < frames ; i++)
+  {
+    for (int c = 0 ; c < 2 ; c++)
+    {
+      const unsigned char* p = pcm + i * frameBytes + min(c, channels - 1) * bitsPerSample / 8;
+      source[2*i + c] = bitsPerSample == 8 ? (p[0] - 128) * 256.0f : (int16_t)readle(p, 2);
+    }
+  }
+
+  // Linear resample to the mixer rate
+  int outFrames = (long long)frames * MIX_RATE / frequency;
+  out.resize(MIX_CHANNELS * outFrames);
+  for (int i = 0 ; i < outFrames ; i++)
+  {
+    double t = (double)i * frequency / MIX_RATE;
+    int j = (int)t;
+    float f = t - j;
+    int k = min(j + 1, frames - 1);
+    for (int c = 0 ; c < 2 ; c++)
+    {
+      out[2*i + c] = (int16_t)(source[2*j + c] * (1 - f) + source[2*k + c] * f);
+    }
+  }
+
+  return true;
+}
+
+/* Mixer thread : start queued sounds, sum the voices and hand the block to libao.
+   ao_play blocks until the device takes the block, which paces the loop */
+static void* mixaudio (void* parg)
+{
+  int32_t mix[MIX_CHANNELS * MIX_FRAMES];
+  int16_t block[MIX_CHANNELS * MIX_FRAMES];
+
+  while (!Audio.quit.load(memory_order_acquire))
+  {
+    unsigned head = Audio.head.load(memory_order_relaxed);
+    unsigned tail = Audio.tail.load(memory_order_acquire);
+    for ( ; head != tail ; head++)
+    {
+      // Take a free voice, or steal the one closest to finishing
+      int sound = Audio.queue[head % QUEUE_SIZE];
+      int chosen = 0, shortest = -1;
+      for (int v = 0 ; v < MAX_VOICES ; v++)
+      {
+        if (Audio.voices[v].sound < 0)
+        {
+          chosen = v;
+          break;
+        }
+        int left = Audio.samples[Audio.voices[v].sound].size() - MIX_CHANNELS * Audio.voices[v].position;
+        if (shortest < 0 || left < shortest)
+        {
+          shortest = left;
+          chosen = v;
+        }
+      }
+      Audio.voices[chosen].sound = sound;
+      Audio.voices[chosen].position = 0;
+    }
+
+    memset(mix, 0, sizeof(mix));
+    int playing = 0;
+    for (int v = 0 ; v < MAX_VOICES ; v++)
+    {
+      Voice& voice = Audio.voices[v];
+      if (voice.sound < 0)
+      {
+        continue;
+      }
+
+      const vector<int16_t>& samples = Audio.samples[voice.sound];
+      int frames = min(MIX_FRAMES, (int)samples.size() / MIX_CHANNELS - voice.position);
+      const int16_t* src = &samples[0] + MIX_CHANNELS * voice.position;
+      for (int i = 0 ; i < MIX_CHANNELS * frames ; i++)
+      {
+        mix[i] += src[i];
+      }
+
+      voice.position += frames;
+      if (voice.position * MIX_CHANNELS >= (int)samples.size())
+      {
+        voice.sound = -1;
+      }
+      else
+      {
+        playing++;
+      }
+    }
+    // Publish the voice count before releasing the queue slots so waitaudio
+    // never sees an empty queue with a stale count
+    Audio.playing.store(playing, memory_order_release);
+    Audio.head.store(head, memory_order_release);
+
+    for (int i = 0 ; i < MIX_CHANNELS * MIX_FRAMES ; i++)
+    {
+      block[i] = mix[i] > 32767 ? 32767 : (mix[i] < -32768 ? -32768 : mix[i]);
+    }
+    ao_play(Audio.device, (char*)block, sizeof(block));
+  }
+
+  return NULL;
+}
+
+bool initaudio ()
+{
+  ao_initialize();
+
+  ao_sample_format format;
+  memset(&format, 0, sizeof(format));
+  format.bits = 16;
+  format.channels = MIX_CHANNELS;
+  format.rate = MIX_RATE;
+  format.byte_format = AO_FMT_LITTLE;
+
+  Audio.device = ao_open_live(ao_default_driver_id(), &format, NULL);
+  if (Audio.device == NULL)
+  {
+    cout << "Unable to open driver" << endl;
+    ao_shutdown();
+    return false;
+  }
+
+  // Sounds that fail to load simply stay silent
+  for (int j = 0 ; j < SOUND_COUNT ; j++)
+  {
+    loadwav(sound_files[j], Audio.samples[j]);
+  }
+  for (int v = 0 ; v < MAX_VOICES ; v++)
+  {
+    Audio.voices[v].sound = -1;
+  }
+
+  Audio.head.store(0);
+  Audio.tail.store(0);
+  Audio.playing.store(0);
+  Audio.quit.store(false);
+  Audio.running = pthread_create(&Audio.thread, NULL, mixaudio, NULL) == 0;
+
+  return Audio.running;
+}
+
+void playsound (Sound sound)
+{
+  if (!Audio.running || Audio.samples[sound].empty())
+  {
+    return;
+  }
+
+  unsigned tail = Audio.tail.load(memory_order_relaxed);
+  if (tail - Audio.head.load(memory_order_acquire) >= QUEUE_SIZE)
+  {
+    return;
+  }
+  Audio.queue[tail % QUEUE_SIZE] = sound;
+  Audio.tail.store(tail + 1, memory_order_release);
+}
+
+void waitaudio ()
+{
+  while (Audio.running &&
+         (Audio.head.load(memory_order_acquire) != Audio.tail.load(memory_order_acquire) ||
+          Audio.playing.load(memory_order_acquire) > 0))
+  {
+    usleep(10000);
+  }
+}
+
+void closeaudio ()
+{
+  if (!Audio.running)
+  {
+    return;
+  }
+
+  Audio.quit.store(true, memory_order_release);
+  pthread_join(Audio.thread, NULL);
+  Audio.running = false;
+
+  ao_close(Audio.device);
+  ao_shutdown();
+}
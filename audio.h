@@ -0,0 +1,28 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+/* Sounds preloaded by initaudio, in the order of their files */
+enum Sound {
+    SOUND_LASER,
+    SOUND_REFLECTION,
+    SOUND_GAME_OVER,
+    SOUND_GAMEOVER,
+    SOUND_COUNT
+};
+
+/* Open the libao device once, decode every WAV into memory and start the
+   mixer thread. Returns false when no device could be opened, in which case
+   playsound is a no-op */
+bool initaudio ();
+
+/* Queue a sound on the mixer. Never blocks or allocates, safe to call from
+   the input callbacks. The sound is dropped if the queue is full */
+void playsound (Sound sound);
+
+/* Block until every queued and playing sound has finished */
+void waitaudio ();
+
+/* Stop the mixer thread and close the device */
+void closeaudio ();
+
+#endif
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <chrono>
+
+#include "game_batch.h"
+#include "game_snapshot.h"
+
+using namespace std;
+
+/* stepbatchenv runs the ticks across the batch instead of calling stepgame,
+   so it must leave every game exactly where stepgame would. Plays the same
+   random actions in a BatchEnv and in games stepped one at a time as
+   stepbatchenv used to, compares rewards, done flags and observations every
+   step and the snapshots of every game now and then, and times both */
+
+static const int games = 1024;
+static const int steps = 3000;
+static const int compare_every = 250;
+
+int main ()
+{
+  GameRandom random;
+  seedrandom(&random, 1);
+
+  vector<int> actions(games * steps);
+  for (size_t j = 0 ; j < actions.size() ; j++)
+  {
+    actions[j] = randomint(&random, BATCH_ACTION_COUNT);
+  }
+
+  vector<uint64_t> seeds(games);
+  for (int i = 0 ; i < games ; i++)
+  {
+    seeds[i] = i + 1;
+  }
+
+  BatchEnv env;
+  initbatchenv(&env, games);
+  resetbatchenv(&env, &seeds[0]);
+
+  // The same rules as stepbatchenv, one game at a time
+  vector<Game> single(games);
+  vector<uint64_t> seed(seeds);
+  vector<int> last_score(games, 0);
+  vector<unsigned char> done(games, 0);
+  vector<float> reward(games, 0);
+  vector<float> observation(games * env.observation_size);
+  for (int i = 0 ; i < games ; i++)
+  {
+    initgame(&single[i], seed[i], 256, env.params);
+  }
+
+  double batch_seconds = 0, single_seconds = 0;
+  int mismatches = 0, ended = 0;
+  vector<unsigned char> a, b;
+
+  for (int s = 0 ; s < steps ; s++)
+  {
+    const int* step_actions = &actions[s * games];
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    stepbatchenv(&env, step_actions);
+    batch_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (int i = 0 ; i < games ; i++)
+    {
+      Game* game = &single[i];
+      if (done[i])
+      {
+        seed[i] += games;
+        initgame(game, seed[i], 256, env.params);
+        last_score[i] = 0;
+      }
+      applybatchaction(game, step_actions[i]);
+      for (int t = 0 ; t < env.ticks_per_step && !game->gameover ; t++)
+      {
+        stepgame(game);
+      }
+      game->events = 0;
+    }
+    for (int i = 0 ; i < games ; i++)
+    {
+      const Game* game = &single[i];
+      reward[i] = game->score - last_score[i];
+      last_score[i] = game->score;
+      done[i] = game->gameover || game->tick >= env.max_ticks;
+    }
+    for (int i = 0 ; i < games ; i++)
+    {
+      observegame(&env, &single[i], &observation[i * env.observation_size]);
+    }
+    single_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for (int i = 0 ; i < games ; i++)
+    {
+      ended += done[i];
+      if (reward[i] != env.reward[i] || done[i] != env.done[i])
+      {
+        mismatches++;
+      }
+    }
+    if (observation != env.observation)
+    {
+      mismatches++;
+    }
+
+    if ((s + 1) % compare_every == 0)
+    {
+      for (int i = 0 ; i < games ; i++)
+      {
+        writesnapshot(&env.games[i], &a);
+        writesnapshot(&single[i], &b);
+        if (a != b)
+        {
+          mismatches++;
+        }
+      }
+    }
+  }
+
+  double ticks = (double)games * steps * env.ticks_per_step;
+  cout << games << " games, " << steps << " steps, " << ended << " games ended, "
+       << mismatches << " mismatches" << endl;
+  cout << "stepbatchenv " << ticks / batch_seconds / 1e6 << "M ticks/s, one game at a time "
+       << ticks / single_seconds / 1e6 << "M ticks/s (" << single_seconds / batch_seconds << "x)" << endl;
+
+  return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,484 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game_core.h"
+
+using namespace std;
+
+/* Headless balance runs : every combination of the swept parameters is played
+   by many games, spread over all cores, and each game is written as a CSV row.
+   Games share nothing, each owns its Game and with it its random generator */
+
+static const char* usage =
+  "usage: batchsim [options]\n"
+  "  --games N           games per parameter combination (100)\n"
+  "  --seed N            seed of the first game, the rest follow on (1)\n"
+  "  --threads N         worker threads (all cores)\n"
+  "  --input bot|script  who plays : a bot aiming at bricks or the benchmark sweep (bot)\n"
+  "  --max-seconds S     stop games still running after S game seconds (600)\n"
+  "  --frequency LIST    starting brick_falling_frequency values (0.25)\n"
+  "  --spawn LIST        seconds between brick batches (5)\n"
+  "  --hits LIST         red or green bricks a player may shoot (5)\n"
+  "  --catch LIST        points for a caught brick (20)\n"
+  "  --hit LIST          points for shooting a red or green brick (-5)\n"
+  "  --black LIST        points for shooting a black brick (50)\n"
+  "  --out FILE          one row per game (stdout)\n"
+  "  --summary FILE      one row per combination with score and length percentiles\n"
+  "LIST is comma separated, e.g. --frequency 0.15,0.25,0.35\n";
+
+enum BatchInput {
+  INPUT_BOT,
+  INPUT_SCRIPT,
+};
+
+struct BatchJob {
+    int combination; // index into the parameter grid
+    uint64_t seed;
+};
+
+struct BatchResult {
+    int score;
+    double seconds; // game time played
+    bool gameover;
+    int redbrickshit,greenbrickshit;
+    int caught; // bricks in both baskets
+};
+
+/* Jobs of one worker. The owner takes from the back and thieves from the
+   front, so they only meet on the last job */
+struct WorkQueue {
+    mutex lock;
+    deque<int> jobs;
+};
+
+struct BatchRun {
+    vector<GameParams> grid;
+    vector<BatchJob> jobs;
+    vector<BatchResult> results; // by job, each written by one worker only
+    vector<WorkQueue> queues;
+    BatchInput input;
+    double max_seconds;
+};
+
+/* Lowest live brick of that colour still above the rims, -1 when there is none */
+static int lowestbrick (const Game* game, int color)
+{
+  int lowest = -1;
+  float lowesty = 0;
+  const BrickPool& bricks = game->bricks;
+  for (size_t j = 0 ; j < bricks.active.size() ; j++)
+  {
+    int index = bricks.active[j];
+    float y = brickheight(game, index);
+    if (bricks.color[index] == color && y > brick_catch_y && (lowest < 0 || y < lowesty))
+    {
+      lowest = index;
+      lowesty = y;
+    }
+  }
+  return lowest;
+}
+
+/* Step a basket half a unit towards catching the brick, the way a player
+   holding alt or ctrl with an arrow key would */
+static void steerbasket (Game* game, const Basket* basket, GameKey hold, int index)
+{
+  if (index < 0)
+  {
+    return;
+  }
+  // A brick is caught with its left side between x - 1.5 and x + 0.8
+  float target = game->bricks.x[index] + 0.35;
+  if (fabs(target - basket->x) < 0.5)
+  {
+    return;
+  }
+  gamekey(game, hold, GAME_PRESS);
+  gamekey(game, target < basket->x ? GAME_KEY_LEFT : GAME_KEY_RIGHT, GAME_PRESS);
+  gamekey(game, hold, GAME_RELEASE);
+}
+
+/* Bot : catch red and green bricks and shoot the black ones, one key per
+   brick colour every tenth of a second like a quick human */
+static void playbot (Game* game)
+{
+  if (game->tick % 10)
+  {
+    return;
+  }
+  steerbasket(game, &game->bask1, GAME_KEY_RED_BASKET, lowestbrick(game, 1));
+  steerbasket(game, &game->bask2, GAME_KEY_GREEN_BASKET, lowestbrick(game, 2));
+
+  int black = lowestbrick(game, 0);
+  if (black < 0)
+  {
+    return;
+  }
+  // Aim at the middle of the brick, leading it by the time the laser takes to get there
+  const Cannon& cannon = game->cannon;
+  float dx = game->bricks.x[black] + 0.35 - cannon.x;
+  float dy = brickheight(game, black) + 0.35 - cannon.y;
+  float flight = sqrt(dx*dx + dy*dy) / (laser_step / game_timestep);
+  dy -= flight * 0.25 / game->brick_falling_frequency;
+  float angle = atan2(dy, dx) * 180 / M_PI;
+
+  if (angle > cannon.rotation + 1)
+  {
+    gamekey(game, GAME_KEY_TILT_UP, GAME_PRESS);
+  }
+  else if (angle < cannon.rotation - 1)
+  {
+    gamekey(game, GAME_KEY_TILT_DOWN, GAME_PRESS);
+  }
+  else if (cannon.active)
+  {
+    gamekey(game, GAME_KEY_FIRE, GAME_PRESS);
+  }
+}
+
+/* Script : the benchmark sweep, turn the cannon back and forth firing whenever it can */
+static void playscript (Game* game)
+{
+  gamekey(game, (game->tick / 240) % 2 ? GAME_KEY_TILT_UP : GAME_KEY_TILT_DOWN, GAME_REPEAT);
+  gamekey(game, GAME_KEY_FIRE, GAME_PRESS);
+}
+
+static void playgame (BatchRun* run, int job)
+{
+  Game game;
+  initgame(&game, run->jobs[job].seed, 256, run->grid[run->jobs[job].combination]);
+
+  while (!game.gameover && game.sim_time < run->max_seconds)
+  {
+    if (run->input == INPUT_BOT)
+    {
+      playbot(&game);
+    }
+    else
+    {
+      playscript(&game);
+    }
+    stepgame(&game);
+  }
+
+  BatchResult& result = run->results[job];
+  result.score = game.score;
+  result.seconds = game.sim_time;
+  result.gameover = game.gameover;
+  result.redbrickshit = game.redbrickshit;
+  result.greenbrickshit = game.greenbrickshit;
+  result.caught = game.bask1.brickcount + game.bask2.brickcount;
+}
+
+/* Next job for worker "self" : its own newest, or else the oldest of another
+   worker. Returns -1 when every queue is empty */
+static int takejob (BatchRun* run, int self)
+{
+  int workers = run->queues.size();
+  for (int k = 0 ; k < workers ; k++)
+  {
+    WorkQueue& queue = run->queues[(self + k) % workers];
+    lock_guard<mutex> guard(queue.lock);
+    if (queue.jobs.empty())
+    {
+      continue;
+    }
+    int job;
+    if (k == 0)
+    {
+      job = queue.jobs.back();
+      queue.jobs.pop_back();
+    }
+    else
+    {
+      job = queue.jobs.front();
+      queue.jobs.pop_front();
+    }
+    return job;
+  }
+  return -1;
+}
+
+static void runworker (BatchRun* run, int self)
+{
+  int job;
+  while ((job = takejob(run, self)) >= 0)
+  {
+    playgame(run, job);
+  }
+}
+
+static bool parselist (const char* text, vector<double>* values)
+{
+  values->clear();
+  const char* p = text;
+  while (*p)
+  {
+    char* end;
+    values->push_back(strtod(p, &end));
+    if (end == p || (*end != ',' && *end != 0))
+    {
+      return false;
+    }
+    p = *end ? end + 1 : end;
+  }
+  return !values->empty();
+}
+
+static double percentile (vector<double>& sorted, double p)
+{
+  return sorted[min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main (int argc, char** argv)
+{
+  int games = 100;
+  uint64_t seed = 1;
+  int threads = thread::hardware_concurrency();
+  const char* out_path = NULL;
+  const char* summary_path = NULL;
+
+  BatchRun run;
+  run.input = INPUT_BOT;
+  run.max_seconds = 600;
+
+  // Every swept parameter starts at its default
+  vector<double> axes[6] = {
+    vector<double>(1, default_game_params.brick_falling_frequency),
+    vector<double>(1, default_game_params.spawn_interval),
+    vector<double>(1, default_game_params.hits_allowed),
+    vector<double>(1, default_game_params.catch_points),
+    vector<double>(1, default_game_params.hit_points),
+    vector<double>(1, default_game_params.black_points),
+  };
+  const char* axis_options[6] = { "--frequency", "--spawn", "--hits", "--catch", "--hit", "--black" };
+
+  for (int i = 1 ; i < argc ; i++)
+  {
+    bool known = false;
+    for (int a = 0 ; a < 6 && i + 1 < argc ; a++)
+    {
+      if (!strcmp(argv[i], axis_options[a]))
+      {
+        if (!parselist(argv[++i], &axes[a]))
+        {
+          cerr << "bad list for " << axis_options[a] << endl;
+          return 1;
+        }
+        known = true;
+        break;
+      }
+    }
+    if (known)
+    {
+      continue;
+    }
+
+    if (!strcmp(argv[i], "--games") && i + 1 < argc)
+    {
+      games = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+    {
+      seed = strtoull(argv[++i], NULL, 10);
+    }
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+    {
+      threads = atoi(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--input") && i + 1 < argc)
+    {
+      i++;
+      if (!strcmp(argv[i], "bot"))
+      {
+        run.input = INPUT_BOT;
+      }
+      else if (!strcmp(argv[i], "script"))
+      {
+        run.input = INPUT_SCRIPT;
+      }
+      else
+      {
+        cerr << usage;
+        return 1;
+      }
+    }
+    else if (!strcmp(argv[i], "--max-seconds") && i + 1 < argc)
+    {
+      run.max_seconds = atof(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+    {
+      out_path = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--summary") && i + 1 < argc)
+    {
+      summary_path = argv[++i];
+    }
+    else
+    {
+      cerr << usage;
+      return 1;
+    }
+  }
+  threads = max(threads, 1);
+
+  if (games <= 0 || !(run.max_seconds > 0))
+  {
+    cerr << "--games and --max-seconds must be above 0\n" << usage;
+    return 1;
+  }
+
+  // Cartesian product of the axes
+  size_t combinations = 1;
+  for (int a = 0 ; a < 6 ; a++)
+  {
+    combinations *= axes[a].size();
+  }
+  for (size_t c = 0 ; c < combinations ; c++)
+  {
+    size_t rest = c;
+    double value[6];
+    for (int a = 5 ; a >= 0 ; a--)
+    {
+      value[a] = axes[a][rest % axes[a].size()];
+      rest /= axes[a].size();
+    }
+    GameParams params = { (float)value[0], value[1], (int)value[2], (int)value[3], (int)value[4], (int)value[5] };
+    run.grid.push_back(params);
+  }
+
+  // The same limits readsnapshot holds a game to, a spawn interval under a
+  // tick would never let a step end
+  for (size_t c = 0 ; c < run.grid.size() ; c++)
+  {
+    if (!validparams(run.grid[c]))
+    {
+      cerr << "--frequency must be within " << min_falling_frequency << ".." << max_falling_frequency
+           << ", --spawn at least " << game_timestep << " and --hits 0 or more\n" << usage;
+      return 1;
+    }
+  }
+
+  // Open the outputs before the run, not to lose it to a bad path
+  ofstream out_file, summary;
+  if (out_path != NULL)
+  {
+    out_file.open(out_path);
+    if (!out_file)
+    {
+      cerr << "Unable to write " << out_path << endl;
+      return 1;
+    }
+  }
+  if (summary_path != NULL)
+  {
+    summary.open(summary_path);
+    if (!summary)
+    {
+      cerr << "Unable to write " << summary_path << endl;
+      return 1;
+    }
+  }
+
+  // Every combination plays the same seeds, so they differ only by the parameters
+  for (size_t c = 0 ; c < combinations ; c++)
+  {
+    for (int g = 0 ; g < games ; g++)
+    {
+      BatchJob job = { (int)c, seed + g };
+      run.jobs.push_back(job);
+    }
+  }
+  run.results.resize(run.jobs.size());
+
+  // Deal the jobs out round robin, idle workers steal the rest
+  run.queues = vector<WorkQueue>(threads);
+  for (size_t j = 0 ; j < run.jobs.size() ; j++)
+  {
+    run.queues[j % threads].jobs.push_back(j);
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<thread> workers;
+  for (int t = 0 ; t < threads ; t++)
+  {
+    workers.push_back(thread(runworker, &run, t));
+  }
+  for (int t = 0 ; t < threads ; t++)
+  {
+    workers[t].join();
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  double simulated = 0;
+  for (size_t j = 0 ; j < run.results.size() ; j++)
+  {
+    simulated += run.results[j].seconds;
+  }
+  cerr << run.jobs.size() << " games on " << threads << " threads in " << seconds << " s, "
+       << (long long)(simulated / game_timestep / seconds) << " ticks/s" << endl;
+
+  ostream& out = out_path != NULL ? out_file : cout;
+  out << "frequency,spawn,hits,catch,hit,black,seed,score,seconds,gameover,red_hit,green_hit,caught\n";
+  for (size_t j = 0 ; j < run.jobs.size() ; j++)
+  {
+    const GameParams& params = run.grid[run.jobs[j].combination];
+    const BatchResult& result = run.results[j];
+    out << params.brick_falling_frequency << ',' << params.spawn_interval << ',' << params.hits_allowed << ','
+        << params.catch_points << ',' << params.hit_points << ',' << params.black_points << ','
+        << run.jobs[j].seed << ',' << result.score << ',' << result.seconds << ',' << result.gameover << ','
+        << result.redbrickshit << ',' << result.greenbrickshit << ',' << result.caught << '\n';
+  }
+
+  if (summary_path != NULL)
+  {
+    summary << "frequency,spawn,hits,catch,hit,black,games,score_mean,score_p10,score_p50,score_p90,"
+               "seconds_mean,seconds_p10,seconds_p50,seconds_p90,gameover_rate\n";
+    for (size_t c = 0 ; c < combinations ; c++)
+    {
+      vector<double> scores, lengths;
+      int overs = 0;
+      for (int g = 0 ; g < games ; g++)
+      {
+        const BatchResult& result = run.results[c * games + g];
+        scores.push_back(result.score);
+        lengths.push_back(result.seconds);
+        overs += result.gameover;
+      }
+      sort(scores.begin(), scores.end());
+      sort(lengths.begin(), lengths.end());
+      double score_sum = 0, length_sum = 0;
+      for (int g = 0 ; g < games ; g++)
+      {
+        score_sum += scores[g];
+        length_sum += lengths[g];
+      }
+
+      const GameParams& params = run.grid[c];
+      summary << params.brick_falling_frequency << ',' << params.spawn_interval << ',' << params.hits_allowed << ','
+              << params.catch_points << ',' << params.hit_points << ',' << params.black_points << ',' << games << ','
+              << score_sum / games << ',' << percentile(scores, 0.1) << ',' << percentile(scores, 0.5) << ','
+              << percentile(scores, 0.9) << ',' << length_sum / games << ',' << percentile(lengths, 0.1) << ','
+              << percentile(lengths, 0.5) << ',' << percentile(lengths, 0.9) << ',' << (double)overs / games << '\n';
+    }
+  }
+
+  out.flush();
+  if (!out || (summary_path != NULL && !summary.flush()))
+  {
+    cerr << "Unable to write the results" << endl;
+    return 1;
+  }
+  return 0;
+}
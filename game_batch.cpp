@@ -0,0 +1,359 @@
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "game_batch.h"
+
+using namespace std;
+
+void initbatchenv (BatchEnv* env, int count, int bricks_observed, int ticks_per_step,
+                   uint32_t max_ticks, const GameParams& params)
+{
+  env->count = count;
+  env->bricks_observed = bricks_observed;
+  env->observation_size = batch_observation_fixed + batch_observation_brick * bricks_observed;
+  env->ticks_per_step = ticks_per_step;
+  env->max_ticks = max_ticks;
+  env->params = params;
+
+  env->games.assign(count, Game());
+  env->sim_time.assign(count, 0);
+  env->tick.assign(count, 0);
+  env->next_timer.assign(count, HUGE_VAL);
+  env->running.assign(count, 0);
+  env->lasers.clear();
+  env->score.assign(count, 0);
+  env->fall_base.assign(count, 0);
+  env->fall_base_time.assign(count, 0);
+  env->fall_speed.assign(count, 0);
+  env->changed.assign(count, 0);
+  env->regrab.assign(count, 0);
+  env->shown.assign(count, 0);
+  env->shown_x.assign(count * bricks_observed, 0);
+  env->shown_fall.assign(count * bricks_observed, 0);
+  env->shown_color.assign(count * bricks_observed, 0);
+  env->seed.assign(count, 0);
+  env->last_score.assign(count, 0);
+  env->reward.assign(count, 0);
+  env->done.assign(count, 0);
+  env->observation.assign(count * env->observation_size, 0);
+}
+
+/* The same keys a player would press, so the rules see no difference */
+void applybatchaction (Game* game, int action)
+{
+  switch (action) {
+    case BATCH_FIRE:
+      gamekey(game, GAME_KEY_FIRE, GAME_PRESS);
+      break;
+    case BATCH_TILT_UP:
+      gamekey(game, GAME_KEY_TILT_UP, GAME_PRESS);
+      break;
+    case BATCH_TILT_DOWN:
+      gamekey(game, GAME_KEY_TILT_DOWN, GAME_PRESS);
+      break;
+    case BATCH_CANNON_UP:
+      gamekey(game, GAME_KEY_CANNON_UP, GAME_PRESS);
+      break;
+    case BATCH_CANNON_DOWN:
+      gamekey(game, GAME_KEY_CANNON_DOWN, GAME_PRESS);
+      break;
+    case BATCH_RED_LEFT:
+    case BATCH_RED_RIGHT:
+      gamekey(game, GAME_KEY_RED_BASKET, GAME_PRESS);
+      gamekey(game, action == BATCH_RED_LEFT ? GAME_KEY_LEFT : GAME_KEY_RIGHT, GAME_PRESS);
+      gamekey(game, GAME_KEY_RED_BASKET, GAME_RELEASE);
+      break;
+    case BATCH_GREEN_LEFT:
+    case BATCH_GREEN_RIGHT:
+      gamekey(game, GAME_KEY_GREEN_BASKET, GAME_PRESS);
+      gamekey(game, action == BATCH_GREEN_LEFT ? GAME_KEY_LEFT : GAME_KEY_RIGHT, GAME_PRESS);
+      gamekey(game, GAME_KEY_GREEN_BASKET, GAME_RELEASE);
+      break;
+    default:
+      break;
+  }
+}
+
+/* The catch queue already holds the bricks above the rims lowest first, so
+   the lowest ones are its live entries in order. Slot of the next one from
+   entry *j on, or -1 */
+static int nextlowestbrick (const Game* game, size_t* j)
+{
+  const BrickPool& bricks = game->bricks;
+  for ( ; *j < game->catchqueue.size() ; (*j)++)
+  {
+    // Shot bricks stay queued until they would have reached the rims
+    const BrickEvent& event = game->catchqueue[*j];
+    int index = event.index;
+    if (brickalive(&bricks, index) && bricks.fall[index] + brick_spawn_y - brick_catch_y == event.fall)
+    {
+      (*j)++;
+      return index;
+    }
+  }
+  return -1;
+}
+
+/* The first observation values, which only actions and the cannon timer change */
+static void observefixed (const Game* game, float* out)
+{
+  out[0] = game->cannon.y / 10;
+  out[1] = game->cannon.rotation / 90;
+  out[2] = game->bask1.x / 10;
+  out[3] = game->bask2.x / 10;
+  out[4] = game->cannon.active;
+}
+
+void observegame (const BatchEnv* env, const Game* game, float* out)
+{
+  observefixed(game, out);
+  out += batch_observation_fixed;
+
+  const BrickPool& bricks = game->bricks;
+  double fall = falldistance(game);
+  int k = 0;
+  size_t j = 0;
+  int index;
+  while (k < env->bricks_observed && (index = nextlowestbrick(game, &j)) >= 0)
+  {
+    float* brick = out + k++ * batch_observation_brick;
+    brick[0] = bricks.x[index] / 10;
+    brick[1] = (brick_spawn_y - (fall - bricks.fall[index])) / 10;
+    brick[2] = bricks.color[index] * 0.5f;
+    brick[3] = 1;
+  }
+  memset(out + k * batch_observation_brick, 0, (env->bricks_observed - k) * batch_observation_brick * sizeof(float));
+}
+
+/* Copy what game i shows of its bricks and its fall into the batch arrays,
+   after the rules ran in it */
+static void readbricks (BatchEnv* env, int i)
+{
+  const Game* game = &env->games[i];
+  const BrickPool& bricks = game->bricks;
+  int first = i * env->bricks_observed;
+  int k = 0;
+  size_t j = 0;
+  int index;
+  while (k < env->bricks_observed && (index = nextlowestbrick(game, &j)) >= 0)
+  {
+    env->shown_x[first + k] = bricks.x[index] / 10;
+    env->shown_fall[first + k] = bricks.fall[index];
+    env->shown_color[first + k] = bricks.color[index] * 0.5f;
+    k++;
+  }
+  env->shown[i] = k;
+  env->fall_base[i] = game->fall_base;
+  env->fall_base_time[i] = game->fall_base_time;
+  env->fall_speed[i] = brickspeed(game);
+  env->changed[i] = 0;
+}
+
+static double nexttimer (const Game* game)
+{
+  return game->timers.empty() ? HUGE_VAL : game->timers.front().time;
+}
+
+/* Bring the game's own clock up to the batch's before the rules run in it */
+static Game* syncgame (BatchEnv* env, int i)
+{
+  Game* game = &env->games[i];
+  game->sim_time = env->sim_time[i];
+  game->tick = env->tick[i];
+  return game;
+}
+
+static bool laserbefore (const BatchLaser& a, const BatchLaser& b)
+{
+  return a.game < b.game || (a.game == b.game && a.slot < b.slot);
+}
+
+static bool samelaser (const BatchLaser& a, const BatchLaser& b)
+{
+  return a.game == b.game && a.slot == b.slot;
+}
+
+void resetbatchenv (BatchEnv* env, const uint64_t* seeds)
+{
+  for (int i = 0 ; i < env->count ; i++)
+  {
+    env->seed[i] = seeds[i];
+    initgame(&env->games[i], seeds[i], 256, env->params);
+    env->score[i] = 0;
+    env->last_score[i] = 0;
+    env->reward[i] = 0;
+    env->done[i] = 0;
+    readbricks(env, i);
+  }
+  env->lasers.clear();
+  for (int i = 0 ; i < env->count ; i++)
+  {
+    observegame(env, &env->games[i], &env->observation[i * env->observation_size]);
+  }
+}
+
+void stepbatchenv (BatchEnv* env, const int* actions)
+{
+  int count = env->count;
+  vector<BatchLaser> fired;
+  vector<int> ended;
+
+  for (int i = 0 ; i < count ; i++)
+  {
+    Game* game = &env->games[i];
+    if (env->done[i])
+    {
+      env->seed[i] += count;
+      initgame(game, env->seed[i], 256, env->params);
+      env->score[i] = 0;
+      env->last_score[i] = 0;
+      env->changed[i] = 1;
+    }
+
+    bool ready = game->cannon.active;
+    applybatchaction(game, actions[i]);
+    if (ready && !game->cannon.active)
+    {
+      BatchLaser laser = {i, game->new_laser_index};
+      fired.push_back(laser);
+    }
+
+    // Only the actions move the baskets and there is no pointer, so what the
+    // first two ticks of stepgame do with them holds for the whole step. The
+    // second tick's updatedrag only differs when the baskets just met
+    env->regrab[i] = 0;
+    if (!game->gameover && env->ticks_per_step > 0)
+    {
+      bool apart = game->bask1.active || game->bask2.active;
+      updatedrag(game);
+      checkcollisionbtwbaskets(game);
+      env->regrab[i] = apart && !game->bask1.active && !game->bask2.active;
+    }
+    observefixed(game, &env->observation[i * env->observation_size]);
+
+    env->sim_time[i] = game->sim_time;
+    env->tick[i] = game->tick;
+    env->next_timer[i] = nexttimer(game);
+    env->running[i] = !game->gameover;
+  }
+
+  // Games that started over lost their lasers, and a laser fired into a slot
+  // that was still in flight is the same entry
+  vector<BatchLaser>& lasers = env->lasers;
+  size_t kept = 0;
+  for (size_t k = 0 ; k < lasers.size() ; k++)
+  {
+    if (env->games[lasers[k].game].lasers[lasers[k].slot].active)
+    {
+      lasers[kept++] = lasers[k];
+    }
+  }
+  lasers.resize(kept);
+  size_t old = lasers.size();
+  lasers.insert(lasers.end(), fired.begin(), fired.end());
+  inplace_merge(lasers.begin(), lasers.begin() + old, lasers.end(), laserbefore);
+  lasers.erase(unique(lasers.begin(), lasers.end(), samelaser), lasers.end());
+
+  for (int t = 0 ; t < env->ticks_per_step ; t++)
+  {
+    for (int i = 0 ; i < count ; i++)
+    {
+      if (env->running[i])
+      {
+        env->sim_time[i] += game_timestep;
+        env->tick[i]++;
+        if (t == 1 && env->regrab[i])
+        {
+          updatedrag(&env->games[i]);
+        }
+      }
+    }
+
+    // A laser that stops has hit a brick or left, either way the game's
+    // bricks are read again after the step
+    kept = 0;
+    for (size_t k = 0 ; k < lasers.size() ; k++)
+    {
+      BatchLaser entry = lasers[k];
+      if (env->running[entry.game])
+      {
+        Game* game = syncgame(env, entry.game);
+        Laser* laser = &game->lasers[entry.slot];
+        steplaser(game, laser);
+        if (game->gameover)
+        {
+          ended.push_back(entry.game);
+        }
+        if (!laser->active)
+        {
+          env->score[entry.game] = game->score;
+          env->changed[entry.game] = 1;
+          continue;
+        }
+      }
+      lasers[kept++] = entry;
+    }
+    lasers.resize(kept);
+
+    for (int i = 0 ; i < count ; i++)
+    {
+      if (env->running[i] && env->next_timer[i] <= env->sim_time[i])
+      {
+        Game* game = syncgame(env, i);
+        runtimers(game);
+        env->next_timer[i] = nexttimer(game);
+        env->score[i] = game->score;
+        env->changed[i] = 1;
+        env->observation[i * env->observation_size + 4] = game->cannon.active;
+        if (game->gameover)
+        {
+          ended.push_back(i);
+        }
+      }
+    }
+
+    // A game that ends during a tick still finishes it, as in stepgame
+    for (size_t k = 0 ; k < ended.size() ; k++)
+    {
+      env->running[ended[k]] = 0;
+    }
+    ended.clear();
+  }
+
+  // Only the games the rules ran in are read again, the rest of the output
+  // comes from the batch arrays
+  for (int i = 0 ; i < count ; i++)
+  {
+    Game* game = syncgame(env, i);
+    game->events = 0;
+    if (env->changed[i])
+    {
+      readbricks(env, i);
+    }
+  }
+
+  for (int i = 0 ; i < count ; i++)
+  {
+    env->reward[i] = env->score[i] - env->last_score[i];
+    env->last_score[i] = env->score[i];
+    env->done[i] = !env->running[i] || env->tick[i] >= env->max_ticks;
+  }
+
+  for (int i = 0 ; i < count ; i++)
+  {
+    float* out = &env->observation[i * env->observation_size + batch_observation_fixed];
+    double fall = env->fall_base[i] + (env->sim_time[i] - env->fall_base_time[i]) * env->fall_speed[i];
+    int first = i * env->bricks_observed;
+    int k = 0;
+    for ( ; k < env->shown[i] ; k++)
+    {
+      float* brick = out + k * batch_observation_brick;
+      brick[0] = env->shown_x[first + k];
+      brick[1] = (brick_spawn_y - (fall - env->shown_fall[first + k])) / 10;
+      brick[2] = env->shown_color[first + k];
+      brick[3] = 1;
+    }
+    memset(out + k * batch_observation_brick, 0, (env->bricks_observed - k) * batch_observation_brick * sizeof(float));
+  }
+}
@@ -0,0 +1,112 @@
+#ifndef GAME_BATCH_H
+#define GAME_BATCH_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "game_core.h"
+
+/* Many games stepped in lockstep for agents to train on. Each step takes one
+   action per game, plays it for ticks_per_step ticks and leaves every game's
+   observation, reward and done flag in flat arrays, instance after instance.
+
+   Each game is still a whole Game, and the rules run in it. The batch holds
+   what changes from tick to tick and from step to step in arrays that span
+   every game : clocks, next timer due, score, fall and the bricks on show.
+   Each tick is then one sweep of the clock arrays, one pass over a single
+   list of the lasers in flight in every game, and timers only in the games
+   where one is due. The output pass builds rewards, done flags and brick
+   observations from the arrays, and only reads a game's bricks again once
+   the rules have run in it. Lasers and bricks themselves stay in their
+   Game, as the rules that move and hit them do.
+
+   Actions are the only input, so the baskets stay put between them and
+   updatedrag and the basket check only need the first two ticks of each
+   step. The games end up exactly where stepgame would leave them, which
+   batchcheck verifies */
+
+enum BatchAction {
+    BATCH_NOOP,
+    BATCH_FIRE,
+    BATCH_TILT_UP,
+    BATCH_TILT_DOWN,
+    BATCH_CANNON_UP,
+    BATCH_CANNON_DOWN,
+    BATCH_RED_LEFT,
+    BATCH_RED_RIGHT,
+    BATCH_GREEN_LEFT,
+    BATCH_GREEN_RIGHT,
+    BATCH_ACTION_COUNT
+};
+
+/* Observation of one game, in world units divided by 10 :
+   cannon y, cannon angle / 90, red basket x, green basket x, cannon ready,
+   then for each of the bricks_observed lowest bricks still above the rims
+   x, y, colour (0 black, 0.5 red, 1 green) and 1, or four zeros when there
+   are fewer bricks */
+static const int batch_observation_fixed = 5;
+static const int batch_observation_brick = 4;
+
+/* An active laser : the game it is in and its slot in game.lasers */
+struct BatchLaser {
+    int game;
+    int slot;
+};
+
+struct BatchEnv {
+    int count;
+    int bricks_observed;
+    int observation_size;
+    int ticks_per_step; // game ticks played per action
+    uint32_t max_ticks; // a game is done after this many ticks even if not over
+    GameParams params;
+
+    std::vector<Game> games;
+
+    // One entry per game, the clocks only move here during a step
+    std::vector<double> sim_time;
+    std::vector<uint32_t> tick;
+    std::vector<double> next_timer; // when the game's earliest timer is due
+    std::vector<unsigned char> running; // not over at the start of the tick
+    std::vector<unsigned char> regrab; // the baskets met this step, the second tick runs updatedrag
+
+    // The active lasers of every game, in game then slot order as stepgame takes them
+    std::vector<BatchLaser> lasers;
+
+    // One entry per game, what the rules last left there : the score, the
+    // fall and the lowest bricks, read again only from games the rules ran in
+    std::vector<int> score;
+    std::vector<double> fall_base;
+    std::vector<double> fall_base_time;
+    std::vector<float> fall_speed;
+    std::vector<unsigned char> changed; // the rules ran in the game this step
+    std::vector<int> shown; // bricks in the observation
+    std::vector<float> shown_x; // count * bricks_observed, observation x
+    std::vector<double> shown_fall; // count * bricks_observed, fall distance at spawn
+    std::vector<float> shown_color; // count * bricks_observed, observation colour
+
+    std::vector<uint64_t> seed; // seed of the game being played
+    std::vector<int> last_score;
+    std::vector<float> reward; // score gained over the last step
+    std::vector<unsigned char> done; // the game ended in the last step
+    std::vector<float> observation; // count * observation_size
+};
+
+void initbatchenv (BatchEnv* env, int count, int bricks_observed = 8, int ticks_per_step = 5,
+                   uint32_t max_ticks = 60000, const GameParams& params = default_game_params);
+
+/* Press the keys that action stands for in one game */
+void applybatchaction (Game* game, int action);
+
+/* Write the observation of one game, observation_size floats */
+void observegame (const BatchEnv* env, const Game* game, float* out);
+
+/* Start every game over, game i from seeds[i] */
+void resetbatchenv (BatchEnv* env, const uint64_t* seeds);
+
+/* Play actions[i] (a BatchAction) in game i. A game that was done after the
+   previous step first starts over from its seed plus count, so the batch
+   never runs short of games */
+void stepbatchenv (BatchEnv* env, const int* actions);
+
+#endif
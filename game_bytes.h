@@ -0,0 +1,79 @@
+#ifndef GAME_BYTES_H
+#define GAME_BYTES_H
+
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+
+/* Little-endian encoding shared by the game files, so they read back the
+   same on any host */
+
+static inline void putle (std::vector<unsigned char>& out, uint64_t value, int bytes)
+{
+  for (int i = 0 ; i < bytes ; i++)
+  {
+    out.push_back((value >> (8 * i)) & 0xff);
+  }
+}
+
+static inline void putfloat (std::vector<unsigned char>& out, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  putle(out, bits, 4);
+}
+
+static inline void putdouble (std::vector<unsigned char>& out, double value)
+{
+  uint64_t bits;
+  memcpy(&bits, &value, 8);
+  putle(out, bits, 8);
+}
+
+/* Reads past the end return zeros and clear ok, so a decoder checks once at the end */
+struct ByteReader {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok;
+};
+
+static inline ByteReader bytereader (const unsigned char* data, size_t size)
+{
+  ByteReader in = { data, data + size, true };
+  return in;
+}
+
+static inline uint64_t getle (ByteReader* in, int bytes)
+{
+  if (in->end - in->p < bytes)
+  {
+    in->p = in->end;
+    in->ok = false;
+    return 0;
+  }
+  uint64_t value = 0;
+  for (int i = bytes - 1 ; i >= 0 ; i--)
+  {
+    value = (value << 8) | in->p[i];
+  }
+  in->p += bytes;
+  return value;
+}
+
+static inline float getfloat (ByteReader* in)
+{
+  uint32_t bits = getle(in, 4);
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+static inline double getdouble (ByteReader* in)
+{
+  uint64_t bits = getle(in, 8);
+  double value;
+  memcpy(&value, &bits, 8);
+  return value;
+}
+
+#endif
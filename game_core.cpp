@@ -0,0 +1,1187 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "game_core.h"
+
+using namespace std;
+
+/**********
+ * Random *
+ **********/
+
+void seedrandom (GameRandom* random, uint64_t seed)
+{
+  // splitmix64 spreads small seeds over the whole state
+  uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z = z ^ (z >> 31);
+  random->state = z ? z : 1;
+}
+
+uint32_t nextrandom (GameRandom* random)
+{
+  uint64_t x = random->state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  random->state = x;
+  return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+int randomint (GameRandom* random, int n)
+{
+  return ((uint64_t)nextrandom(random) * n) >> 32;
+}
+
+/**********
+ * Timers *
+ **********/
+
+/* Heap order, the earliest timer on top */
+bool latertimer (const GameTimer& a, const GameTimer& b)
+{
+  if (a.time != b.time)
+  {
+    return a.time > b.time;
+  }
+  return a.order > b.order;
+}
+
+void settimer (Game* game, int kind, double time)
+{
+  GameTimer timer = { time, game->timer_order++, kind, game->fall_generation };
+  game->timers.push_back(timer);
+  push_heap(game->timers.begin(), game->timers.end(), latertimer);
+}
+
+/**************
+ * Brick pool *
+ **************/
+
+void initbrickpool (BrickPool* bricks, int capacity)
+{
+  bricks->x.assign(capacity, 0);
+  bricks->fall.assign(capacity, 0);
+  bricks->color.assign(capacity, 0);
+  bricks->alive.assign((capacity + 63) / 64, 0);
+  bricks->slot.assign(capacity, -1);
+  bricks->active.clear();
+  bricks->active.reserve(capacity);
+  bricks->freelist.clear();
+  for (int c = 0 ; c < brick_column_count ; c++)
+  {
+    bricks->columns[c].clear();
+  }
+  for (int j = capacity - 1 ; j >= 0 ; j--)
+  {
+    bricks->freelist.push_back(j);
+  }
+}
+
+/* Return a brick slot to the free list, moving the last live brick into its place */
+void releasebrick (BrickPool* bricks, int index)
+{
+  int position = bricks->slot[index];
+  int last = bricks->active.back();
+
+  bricks->active[position] = last;
+  bricks->slot[last] = position;
+  bricks->active.pop_back();
+
+  vector<int>& column = bricks->columns[(int)bricks->x[index] - brick_column_min];
+  for (int k = 0 ; k < column.size() ; k++)
+  {
+    if (column[k] == index)
+    {
+      column.erase(column.begin() + k);
+      break;
+    }
+  }
+
+  bricks->slot[index] = -1;
+  bricks->alive[index / 64] &= ~(1ULL << (index % 64));
+  bricks->freelist.push_back(index);
+  bricks->version++;
+}
+
+bool brickalive (const BrickPool* bricks, int index)
+{
+  return (bricks->alive[index / 64] >> (index % 64)) & 1;
+}
+
+/* Take a brick slot from the pool at the top of column X. Returns -1 when the pool is full */
+int createbrick (BrickPool* bricks, int colour, float X, double fall)
+{
+  if (bricks->freelist.empty())
+  {
+    return -1;
+  }
+
+  int index = bricks->freelist.back();
+  bricks->freelist.pop_back();
+  bricks->slot[index] = bricks->active.size();
+  bricks->active.push_back(index);
+  bricks->version++;
+
+  bricks->x[index] = X;
+  bricks->fall[index] = fall;
+  bricks->color[index] = colour;
+  bricks->alive[index / 64] |= 1ULL << (index % 64);
+
+  // Everything already in the column has fallen, so the new brick is the highest
+  bricks->columns[(int)X - brick_column_min].push_back(index);
+
+  return index;
+}
+
+/********
+ * Fall *
+ ********/
+
+float brickspeed (const Game* game)
+{
+  return 0.25 / game->brick_falling_frequency;
+}
+
+double falldistance (const Game* game)
+{
+  return game->fall_base + (game->sim_time - game->fall_base_time) * brickspeed(game);
+}
+
+double falltime (const Game* game, double fall)
+{
+  return game->fall_base_time + (fall - game->fall_base) / brickspeed(game);
+}
+
+float brickheight (const Game* game, int index)
+{
+  return brick_spawn_y - (falldistance(game) - game->bricks.fall[index]);
+}
+
+/* Change the fall speed from now on, bricks keep the height they have.
+   The fall timers move with it */
+void setfallingfrequency (Game* game, float frequency)
+{
+  game->fall_base = falldistance(game);
+  game->fall_base_time = game->sim_time;
+  game->brick_falling_frequency = frequency;
+
+  game->fall_generation++;
+  if (!game->catchqueue.empty())
+  {
+    settimer(game, TIMER_CATCH, falltime(game, game->catchqueue.front().fall));
+  }
+  if (!game->lostqueue.empty())
+  {
+    settimer(game, TIMER_LOST, falltime(game, game->lostqueue.front().fall));
+  }
+}
+
+/* Spawn up to 8 bricks in distinct columns that are clear of the mirrors */
+void createbricks (Game* game)
+{
+  bool waiting = !game->catchqueue.empty();
+  int Y = randomint(&game->random, 8) + 1;
+  vector<float> a;
+  for (int j =0 ; j < Y ; j++)
+  {
+    float X = randomint(&game->random, brick_column_count) + brick_column_min;
+    int colour = randomint(&game->random, 3);
+    int k = 0;
+    for ( k = 0 ; k < a.size(); k++)
+    {
+      if (a[k] == X)
+      {
+        break;
+      }
+    }
+    int u = 0;
+    for ( u =0 ; u < game->mirrors.size();u++)
+    {
+      const Mirror& mirror = game->mirrors[u];
+      if ( X <= mirror.x + fabs(cos(mirror.angle*M_PI/180.0f)) &&
+           X >= mirror.x - fabs(cos(mirror.angle*M_PI/180.0f))-0.7
+          )
+          {
+            break;
+          }
+    }
+    if ( k == a.size() && u == game->mirrors.size())
+    {
+      double fall = falldistance(game);
+      int index = createbrick(&game->bricks, colour, X, fall);
+      if (index < 0)
+      {
+        break;
+      }
+      a.push_back(X);
+
+      // Predict when it reaches the rims and the bottom of the screen
+      BrickEvent event = { index, fall + brick_spawn_y - brick_catch_y };
+      game->catchqueue.push_back(event);
+    }
+
+  }
+
+  game->totalbrickcount += Y;
+
+  // Later bricks are behind the current front, which already has its timer
+  if (!waiting && !game->catchqueue.empty())
+  {
+    settimer(game, TIMER_CATCH, falltime(game, game->catchqueue.front().fall));
+  }
+}
+
+/**************
+ * Collisions *
+ **************/
+
+void checkcollisionbtwbaskets (Game* game)
+{
+  // Overlapping baskets cannot collect
+  bool apart = fabs(game->bask1.x - game->bask2.x) >= 3;
+  game->bask1.active = apart;
+  game->bask2.active = apart;
+}
+
+void addscore (Game* game, int points)
+{
+  game->score += points;
+  game->events |= GAME_EVENT_SCORE;
+}
+
+/* Called once for each brick, at the moment it reaches the rims. True when a basket caught it */
+bool checkcollisionbtwbrickbasket (Game* game, int index)
+{
+  Basket* bask1 = &game->bask1;
+  Basket* bask2 = &game->bask2;
+  float x = game->bricks.x[index];
+  int color = game->bricks.color[index];
+  bool caught = false;
+
+  if (((x >= bask2->x - 1.5)&&(x <=bask2->x + 0.8))
+        &&(bask2->active == true))
+  {
+    if (color == 2)
+    {
+      caught = true;
+      bask2->brickcount++;
+      addscore(game, game->params.catch_points);
+    }
+    else if (color == 0)
+    {
+      game->gameover = true;
+    }
+
+  }
+
+  if (((x >= bask1->x - 1.5)&&(x <=bask1->x + 0.8))
+      &&(bask1->active == true) && (caught == false))
+  {
+    if (color == 1)
+    {
+      caught = true;
+      bask1->brickcount++;
+      addscore(game, game->params.catch_points);
+    }
+    else if (color == 0)
+    {
+      game->gameover = true;
+    }
+
+  }
+
+  return caught;
+}
+
+/* Distance along the ray from (x,y) heading (dx,dy) to where it leaves the walls */
+float distancetowalls (float x, float y, float dx, float dy)
+{
+  float distance = 1e30;
+  if (dx > 0) distance = min(distance, (10 - x)/dx);
+  if (dx < 0) distance = min(distance, (-10 - x)/dx);
+  if (dy > 0) distance = min(distance, (10 - y)/dy);
+  if (dy < 0) distance = min(distance, (-7.5f - y)/dy);
+  return max(distance, 0.0f);
+}
+
+/* True when segment (x1,y1)-(x2,y2) properly crosses segment (x3,y3)-(x4,y4) */
+bool checkintersection (float x1 , float y1,float x2, float y2, float x3, float y3, float x4 , float y4)
+{
+  return ( (
+             ((y3-y1)*(x2-x1)-(y2-y1)*(x3-x1))*
+             ((y4-y1)*(x2-x1)-(y2-y1)*(x4-x1)) < 0
+           ) &&
+           (
+             ((y1-y3)*(x4-x3)-(y4-y3)*(x1-x3))*
+             ((y2-y3)*(x4-x3)-(y4-y3)*(x2-x3)) < 0
+           )
+         );
+}
+
+/* checkintersection against four segments at once. Bit i of the result is set
+   when (x1,y1)-(x2,y2) properly crosses (x3[i],y3[i])-(x4[i],y4[i]) */
+int checkintersection4 (float x1, float y1, float x2, float y2,
+                        const float* x3, const float* y3, const float* x4, const float* y4)
+{
+#ifdef __SSE2__
+  __m128 X1 = _mm_set1_ps(x1), Y1 = _mm_set1_ps(y1);
+  __m128 X2 = _mm_set1_ps(x2), Y2 = _mm_set1_ps(y2);
+  __m128 DX = _mm_set1_ps(x2 - x1), DY = _mm_set1_ps(y2 - y1);
+  __m128 X3 = _mm_loadu_ps(x3), Y3 = _mm_loadu_ps(y3);
+  __m128 X4 = _mm_loadu_ps(x4), Y4 = _mm_loadu_ps(y4);
+  __m128 EX = _mm_sub_ps(X4, X3), EY = _mm_sub_ps(Y4, Y3);
+  __m128 zero = _mm_setzero_ps();
+
+  // Same products as checkintersection, in the same order, so both agree exactly
+  __m128 side3 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(Y3, Y1), DX), _mm_mul_ps(DY, _mm_sub_ps(X3, X1)));
+  __m128 side4 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(Y4, Y1), DX), _mm_mul_ps(DY, _mm_sub_ps(X4, X1)));
+  __m128 side1 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(Y1, Y3), EX), _mm_mul_ps(EY, _mm_sub_ps(X1, X3)));
+  __m128 side2 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(Y2, Y3), EX), _mm_mul_ps(EY, _mm_sub_ps(X2, X3)));
+
+  __m128 crossed = _mm_and_ps(_mm_cmplt_ps(_mm_mul_ps(side3, side4), zero),
+                              _mm_cmplt_ps(_mm_mul_ps(side1, side2), zero));
+  return _mm_movemask_ps(crossed);
+#else
+  int mask = 0;
+  for (int i = 0 ; i < 4 ; i++)
+  {
+    if (checkintersection(x1,y1,x2,y2,x3[i],y3[i],x4[i],y4[i]))
+    {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+#endif
+}
+
+/* Bit i set when the segment crosses any edge of the brick with bottom left
+   corner (left[i],bottom[i]) */
+int checkcollisionbricks4 (float x1, float y1, float x2, float y2, const float* left, const float* bottom)
+{
+  float right[4], top[4];
+  for (int i = 0 ; i < 4 ; i++)
+  {
+    right[i] = left[i] + 0.7f;
+    top[i] = bottom[i] + 0.7f;
+  }
+
+  return checkintersection4(x1,y1,x2,y2, left,bottom,left,top) |
+         checkintersection4(x1,y1,x2,y2, left,bottom,right,bottom) |
+         checkintersection4(x1,y1,x2,y2, right,top,left,top) |
+         checkintersection4(x1,y1,x2,y2, right,top,right,bottom);
+}
+
+/* First brick in a column whose bottom is not below "y" once everything has fallen "fall" */
+int lowerbrickbound (const BrickPool* bricks, const vector<int>& column, double fall, float y)
+{
+  int lo = 0, hi = column.size();
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (brick_spawn_y - (fall - bricks->fall[column[mid]]) < y)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* How far along the segment, 0 to 1, it enters the brick at (left, bottom) */
+float brickentry (float x1, float y1, float x2, float y2, float left, float bottom)
+{
+  float dx = x2 - x1, dy = y2 - y1;
+  float tx = 0, ty = 0;
+  if (dx != 0)
+  {
+    tx = min((left - x1) / dx, (left + 0.7f - x1) / dx);
+  }
+  if (dy != 0)
+  {
+    ty = min((bottom - y1) / dy, (bottom + 0.7f - y1) / dy);
+  }
+  return max(max(tx, ty), 0.0f);
+}
+
+/* Test the laser against "count" gathered bricks four at a time and keep the
+   one it enters first in *nearest, at *entry along the segment */
+void nearestbrick (float x1, float y1, float x2, float y2, const int* candidates,
+                   float* left, float* bottom, int count, int* nearest, float* entry)
+{
+  // Unused lanes are pushed far out of reach
+  for (int i = count ; i < ((count + 3) & ~3) ; i++)
+  {
+    left[i] = bottom[i] = 1e6;
+  }
+
+  for (int i = 0 ; i < count ; i += 4)
+  {
+    int mask = checkcollisionbricks4(x1,y1,x2,y2, left + i, bottom + i);
+    while (mask != 0)
+    {
+      int k = i + __builtin_ctz(mask);
+      mask &= mask - 1;
+      float t = brickentry(x1,y1,x2,y2, left[k], bottom[k]);
+      // Exact ties go to the lower slot, so the result does not depend on the gathering order
+      if (*nearest < 0 || t < *entry || (t == *entry && candidates[k] < *nearest))
+      {
+        *nearest = candidates[k];
+        *entry = t;
+      }
+    }
+  }
+}
+
+/* Destroy the brick the laser hit and score it */
+void hitbrick (Game* game, Laser* laser, int j)
+{
+  BrickPool* bricks = &game->bricks;
+
+  laser->active = false;
+  game->lasers_version++;
+  if (bricks->color[j] == 1)
+  {
+    game->redbrickshit++;
+    addscore(game, game->params.hit_points);
+  }
+  else if (bricks->color[j] == 2)
+  {
+    game->greenbrickshit++;
+    addscore(game, game->params.hit_points);
+  }
+  else if (bricks->color[j] == 0)
+  {
+    addscore(game, game->params.black_points);
+  }
+  if (game->redbrickshit > game->params.hits_allowed || game->greenbrickshit > game->params.hits_allowed)
+  {
+    game->gameover = true;
+  }
+  releasebrick(bricks, j);
+}
+
+/* Test the laser against the bricks in the columns its segment crosses. When
+   it crosses more than one in a tick, the one nearest its tail is destroyed */
+void checkcollisionbtwlaserbrick (Game* game, Laser* laser)
+{
+  BrickPool* bricks = &game->bricks;
+
+  float x1 = laser->x;
+  float y1 = laser->y;
+  float x2 = laser->x + 1*cos(laser->inclination*M_PI/180.0f);
+  float y2 = laser->y + 1*sin(laser->inclination*M_PI/180.0f);
+
+  // A brick spans [x, x+0.7] x [y, y+0.7]
+  float minx = min(x1, x2), maxx = max(x1, x2);
+  float miny = min(y1, y2), maxy = max(y1, y2);
+  int firstcolumn = max((int)ceil(minx - 0.7) - brick_column_min, 0);
+  int lastcolumn = min((int)floor(maxx) - brick_column_min, brick_column_count - 1);
+  double fall = falldistance(game);
+
+  // Gather the bricks the segment may reach, column by column, and test
+  // their edges four bricks at a time
+  int candidates[8];
+  float left[8], bottom[8];
+  int count = 0;
+  int nearest = -1;
+  float entry = 0;
+  for (int c = firstcolumn; c <= lastcolumn; c++)
+  {
+    const vector<int>& column = bricks->columns[c];
+    for (int k = lowerbrickbound(bricks, column, fall, miny - 0.7); k < column.size(); k++)
+    {
+      int j = column[k];
+      float by = brick_spawn_y - (fall - bricks->fall[j]);
+      if (by > maxy)
+      {
+        break;
+      }
+
+      candidates[count] = j;
+      left[count] = bricks->x[j];
+      bottom[count] = by;
+      count++;
+      if (count == 8)
+      {
+        nearestbrick(x1,y1,x2,y2, candidates, left, bottom, count, &nearest, &entry);
+        count = 0;
+      }
+    }
+  }
+  nearestbrick(x1,y1,x2,y2, candidates, left, bottom, count, &nearest, &entry);
+
+  if (nearest >= 0)
+  {
+    hitbrick(game, laser, nearest);
+  }
+}
+
+/* Cast the laser from (x,y) at "angle" degrees through every mirror bounce up to
+   the wall it leaves by, and put its tail at the start of the path */
+void tracelaser (Game* game, Laser* laser, float x, float y, float angle)
+{
+  int skip = -1; // mirror the ray just left, so it can not hit it again at distance 0
+  laser->legs = 0;
+  while (laser->legs < laser_max_legs)
+  {
+    float dx = cos(angle*M_PI/180.0f);
+    float dy = sin(angle*M_PI/180.0f);
+
+    float nearest = distancetowalls(x, y, dx, dy);
+    int hit = -1;
+    for (int j = 0; j < game->mirrors.size(); j++)
+    {
+      const Mirror& mirror = game->mirrors[j];
+      if (j == skip)
+      {
+        continue;
+      }
+
+      // Solve (x,y) + s*(dx,dy) = mirror + m*(mx,my) with |m| <= 1
+      float mx = cos(mirror.angle*M_PI/180.0f);
+      float my = sin(mirror.angle*M_PI/180.0f);
+      float denominator = dx*my - dy*mx;
+      if (fabs(denominator) < 1e-6)
+      {
+        continue;
+      }
+      float ox = mirror.x - x, oy = mirror.y - y;
+      float s = (ox*my - oy*mx) / denominator;
+      float m = (ox*dy - oy*dx) / denominator;
+      if (s > 0 && s < nearest && fabs(m) < 1)
+      {
+        nearest = s;
+        hit = j;
+      }
+    }
+
+    int k = laser->legs++;
+    laser->pathx[k] = x;
+    laser->pathy[k] = y;
+    laser->pathangle[k] = angle;
+    laser->pathlength[k] = nearest;
+    if (hit < 0)
+    {
+      break;
+    }
+
+    x += nearest*dx;
+    y += nearest*dy;
+    angle = 2*game->mirrors[hit].angle - angle;
+    skip = hit;
+  }
+
+  laser->leg = 0;
+  laser->along = 0;
+  laser->legtime = game->sim_time;
+  game->lasers_version++;
+  laser->x = laser->pathx[0];
+  laser->y = laser->pathy[0];
+  laser->inclination = laser->pathangle[0];
+}
+
+/* Move the tail "distance" units along the path. When the head passes a bounce
+   the tail snaps onto it and turns, when it passes the wall the laser dies */
+void advancelaser (Game* game, Laser* laser, float distance)
+{
+  laser->along += distance;
+  if (laser->along + 1 > laser->pathlength[laser->leg])
+  {
+    game->lasers_version++;
+    if (laser->leg + 1 == laser->legs)
+    {
+      laser->active = false;
+      return;
+    }
+    laser->leg++;
+    laser->along = 0;
+    laser->legtime = game->sim_time;
+    game->events |= GAME_EVENT_REFLECTION;
+  }
+
+  int k = laser->leg;
+  laser->inclination = laser->pathangle[k];
+  laser->x = laser->pathx[k] + laser->along*cos(laser->inclination*M_PI/180.0f);
+  laser->y = laser->pathy[k] + laser->along*sin(laser->inclination*M_PI/180.0f);
+}
+
+/* Basket check for every brick that has reached the rims, then set the timer
+   for the next one */
+void catchbricks (Game* game)
+{
+  BrickPool* bricks = &game->bricks;
+  bool waiting = !game->lostqueue.empty();
+
+  // Timers fire on the step, so allow for rounding in the fall distance
+  double fall = falldistance(game) + 1e-6;
+  while (!game->catchqueue.empty() && game->catchqueue.front().fall <= fall)
+  {
+    BrickEvent event = game->catchqueue.front();
+    game->catchqueue.pop_front();
+
+    // The brick may have been shot and its slot reused since
+    int j = event.index;
+    if (!brickalive(bricks, j) || bricks->fall[j] + brick_spawn_y - brick_catch_y != event.fall)
+    {
+      continue;
+    }
+
+    if (checkcollisionbtwbrickbasket(game, j))
+    {
+      releasebrick(bricks, j);
+    }
+    else
+    {
+      event.fall = bricks->fall[j] + brick_spawn_y - brick_lost_y;
+      game->lostqueue.push_back(event);
+    }
+  }
+
+  if (!game->catchqueue.empty())
+  {
+    settimer(game, TIMER_CATCH, falltime(game, game->catchqueue.front().fall));
+  }
+  if (!waiting && !game->lostqueue.empty())
+  {
+    settimer(game, TIMER_LOST, falltime(game, game->lostqueue.front().fall));
+  }
+}
+
+/* Missed bricks leave the pool once they drop below the screen */
+void losebricks (Game* game)
+{
+  BrickPool* bricks = &game->bricks;
+
+  double fall = falldistance(game) + 1e-6;
+  while (!game->lostqueue.empty() && game->lostqueue.front().fall <= fall)
+  {
+    BrickEvent event = game->lostqueue.front();
+    game->lostqueue.pop_front();
+
+    int j = event.index;
+    if (brickalive(bricks, j) && bricks->fall[j] + brick_spawn_y - brick_lost_y == event.fall)
+    {
+      releasebrick(bricks, j);
+    }
+  }
+
+  if (!game->lostqueue.empty())
+  {
+    settimer(game, TIMER_LOST, falltime(game, game->lostqueue.front().fall));
+  }
+}
+
+/*********
+ * Input *
+ *********/
+
+/* Snap a dragged coordinate to the nearest half unit */
+float parse (float x)
+{
+  float integer,frac = modf(x, &integer);
+  if (frac >= 0.75 )
+  {
+    return integer + 1;
+  }
+  else if (frac >= 0.25)
+  {
+    return integer + 0.5;
+  }
+  else if (frac >= -0.25)
+  {
+    return integer;
+  }
+  else if (frac >= -0.75)
+  {
+    return integer - 0.5;
+  }
+  return integer - 1;
+}
+
+/* Shoot the next laser in the ring from the cannon mouth */
+void firelaser (Game* game)
+{
+  Cannon* cannon = &game->cannon;
+
+  game->new_laser_index = (game->new_laser_index + 1) % game->lasers.size();
+  Laser* laser = &game->lasers[game->new_laser_index];
+  tracelaser(game, laser,
+             cannon->x + 2*cos(cannon->rotation*M_PI/180.0f),
+             cannon->y + 2*sin(cannon->rotation*M_PI/180.0f),
+             cannon->rotation);
+  laser->active = true;
+  cannon->active = false;
+  cannon->latest_fire_time = game->sim_time;
+  settimer(game, TIMER_CANNON, game->sim_time + 1);
+  game->events |= GAME_EVENT_LASER;
+}
+
+void tiltcannon (Cannon* cannon, float dir)
+{
+  if ( ((cannon->rotation < 90 )&&(cannon->rotation > -90))
+       || ((cannon->rotation == 90) && (dir == -1))
+       || ((cannon->rotation == -90) && (dir == 1))
+     )
+  {
+    cannon->rotation = cannon->rotation + dir;
+  }
+}
+
+void movebasket (Basket* basket, float dx)
+{
+  basket->x += dx;
+  basket->x = basket->x > 8.5 ? 8.5 : (basket->x < -8.5 ? -8.5 : basket->x);
+}
+
+void zoomin (Game* game)
+{
+  game->bnx = game->bnx >= -5 ? -5 : game->bnx + 1;
+  game->bny = game->bny >= -5 ? -5 : game->bny + 1;
+  game->bx = game->bx <= 5 ? 5 : game->bx - 1;
+  game->by = game->by <= 5 ? 5 : game->by - 1;
+}
+
+void zoomout (Game* game)
+{
+  game->bnx = game->bnx <= -10 ? -10 : game->bnx - 1;
+  game->bny = game->bny <= -10 ? -10 : game->bny - 1;
+  game->bx = game->bx >= 10 ? 10 : game->bx + 1;
+  game->by = game->by >= 10 ? 10 : game->by + 1;
+}
+
+/* Append an input call to the log when recording */
+void recordinput (Game* game, int type, int code, int action, float a, float b)
+{
+  if (game->recording)
+  {
+    GameInput input = { game->tick, (uint8_t)type, (uint8_t)code, (uint8_t)action, a, b };
+    game->inputlog.push_back(input);
+  }
+}
+
+void gamekey (Game* game, GameKey key, GameAction action)
+{
+  recordinput(game, GAME_INPUT_KEY, key, action, 0, 0);
+
+  if (action == GAME_RELEASE)
+  {
+    switch (key) {
+      case GAME_KEY_GREEN_BASKET:
+        game->ctrlflag = false;
+        break;
+      case GAME_KEY_RED_BASKET:
+        game->altflag = false;
+        break;
+      default:
+        break;
+    }
+    return;
+  }
+
+  Cannon* cannon = &game->cannon;
+  switch (key) {
+    case GAME_KEY_GREEN_BASKET:
+      game->ctrlflag = true;
+      break;
+    case GAME_KEY_RED_BASKET:
+      game->altflag = true;
+      break;
+
+    case GAME_KEY_FIRE:
+      if ((action == GAME_PRESS) && (cannon->active))
+      {
+        firelaser(game);
+      }
+      break;
+
+    case GAME_KEY_FASTER:
+      setfallingfrequency(game, max(game->brick_falling_frequency - 0.1f, 0.05f));
+      break;
+
+    case GAME_KEY_SLOWER:
+      setfallingfrequency(game, min(game->brick_falling_frequency + 0.1f, 0.45f));
+      break;
+
+    case GAME_KEY_CANNON_DOWN:
+      cannon->y = cannon->y <= -5.5 ? -5.5 : cannon->y - 0.5;
+      break;
+
+    case GAME_KEY_CANNON_UP:
+      cannon->y = cannon->y >= 8 ? 8 : cannon->y + 0.5;
+      break;
+
+    case GAME_KEY_TILT_UP:
+      tiltcannon(cannon, 1);
+      break;
+
+    case GAME_KEY_TILT_DOWN:
+      tiltcannon(cannon, -1);
+      break;
+
+    case GAME_KEY_LEFT:
+      if (game->altflag)
+      {
+        movebasket(&game->bask1, -0.5);
+      }
+      else if (game->ctrlflag)
+      {
+        movebasket(&game->bask2, -0.5);
+      }
+      else if (game->bnx - 1 >= -10)
+      {
+        game->bx--;
+        game->bnx--;
+      }
+      break;
+
+    case GAME_KEY_RIGHT:
+      if (game->altflag)
+      {
+        movebasket(&game->bask1, 0.5);
+      }
+      else if (game->ctrlflag)
+      {
+        movebasket(&game->bask2, 0.5);
+      }
+      else if (game->bx + 1 <= 10)
+      {
+        game->bx++;
+        game->bnx++;
+      }
+      break;
+
+    case GAME_KEY_UP:
+      zoomin(game);
+      break;
+
+    case GAME_KEY_DOWN:
+      zoomout(game);
+      break;
+
+    default:
+      break;
+  }
+}
+
+void gamebutton (Game* game, GameButton button, GameAction action)
+{
+  recordinput(game, GAME_INPUT_BUTTON, button, action, 0, 0);
+
+  Cannon* cannon = &game->cannon;
+  float xpos = game->xpos, ypos = game->ypos;
+
+  switch (button) {
+    case GAME_BUTTON_LEFT:
+      if (action == GAME_PRESS)
+      {
+        game->mouse_left_drag = true;
+
+        // Clicking away from the cannon aims and fires at the pointer
+        if (xpos >= -9 && ypos > -7.5 && cannon->active
+            && (sqrt((cannon->x-xpos)*(cannon->x-xpos)
+            +(cannon->y-ypos)*(cannon->y-ypos)) > 1)
+            )
+        {
+          cannon->rotation = atan((double)(ypos - cannon->y)/
+                                        (xpos - cannon->x))*180/M_PI;
+          firelaser(game);
+        }
+      }
+
+      if (action == GAME_RELEASE)
+      {
+        game->mouse_left_drag = false;
+
+        if (cannon->drag == true)
+        {
+          cannon->drag = false;
+          cannon->y = parse(cannon->y);
+        }
+        if (game->bask1.drag == true)
+        {
+          game->bask1.drag = false;
+          game->bask1.x = parse(game->bask1.x);
+        }
+        if (game->bask2.drag == true)
+        {
+          game->bask2.drag = false;
+          game->bask2.x = parse(game->bask2.x);
+        }
+      }
+      break;
+
+    case GAME_BUTTON_RIGHT:
+      if (action == GAME_PRESS)
+      {
+        game->mouse_right_drag = true;
+        game->mxpos = xpos;
+        game->mypos = ypos;
+      }
+      if (action == GAME_RELEASE)
+      {
+        game->mouse_right_drag = false;
+      }
+      break;
+  }
+}
+
+void gamepointer (Game* game, float x, float y)
+{
+  recordinput(game, GAME_INPUT_POINTER, 0, 0, x, y);
+  game->xpos = x;
+  game->ypos = y;
+}
+
+void gamescroll (Game* game, float yoffset)
+{
+  recordinput(game, GAME_INPUT_SCROLL, 0, 0, yoffset, 0);
+
+  if (yoffset == 1)
+  {
+    zoomin(game);
+  }
+  else if (yoffset == -1)
+  {
+    zoomout(game);
+  }
+}
+
+/* Make the call a recorded input stood for, so replays go through the same code */
+void applyinput (Game* game, const GameInput& input)
+{
+  switch (input.type)
+  {
+    case GAME_INPUT_KEY:
+      gamekey(game, (GameKey)input.code, (GameAction)input.action);
+      break;
+    case GAME_INPUT_BUTTON:
+      gamebutton(game, (GameButton)input.code, (GameAction)input.action);
+      break;
+    case GAME_INPUT_POINTER:
+      gamepointer(game, input.a, input.b);
+      break;
+    case GAME_INPUT_SCROLL:
+      gamescroll(game, input.a);
+      break;
+  }
+}
+
+/* Apply the held mouse buttons : right drag pans, left drag moves the cannon or a basket */
+void updatedrag (Game* game)
+{
+  float xpos = game->xpos, ypos = game->ypos;
+  float mxpos = game->mxpos;
+  Cannon* cannon = &game->cannon;
+  Basket* bask1 = &game->bask1;
+  Basket* bask2 = &game->bask2;
+
+  if (game->mouse_right_drag)
+  {
+    if (xpos < mxpos)
+    {
+      if (game->bnx-(mxpos-xpos) >= -10)
+      {
+        game->bnx = game->bnx-(mxpos-xpos);
+        game->bx = game->bx-(mxpos-xpos);
+      }
+    }
+    else if (xpos > mxpos)
+    {
+      if (game->bx + (xpos-mxpos) <= 10)
+      {
+        game->bnx = game->bnx + (xpos-mxpos);
+        game->bx = game->bx + (xpos-mxpos);
+      }
+    }
+  }
+
+  if ((sqrt((cannon->x-xpos)*(cannon->x-xpos)
+      +(cannon->y-ypos)*(cannon->y-ypos)) < 1) && game->mouse_left_drag)
+  {
+    cannon->drag = true;
+    cannon->y = ypos > 8 ? 8 : (ypos < -5.5 ? -5.5 : ypos);
+  }
+
+  // Overlapping baskets : keep dragging the one already held, else the nearer one
+  if (bask1->active == false && bask2->active == false)
+  {
+    if (game->mouse_left_drag)
+    {
+      if (bask1->drag == true)
+      {
+        game->drag_basket = 1;
+      }
+      else if (bask2->drag == true)
+      {
+        game->drag_basket = 2;
+      }
+    }
+    else
+    {
+      if (sqrt((bask1->x-xpos)*(bask1->x-xpos)+(bask1->y-ypos)*(bask1->y-ypos)) >
+          sqrt((bask2->x-xpos)*(bask2->x-xpos)+(bask2->y-ypos)*(bask2->y-ypos)))
+      {
+        game->drag_basket = 2;
+      }
+      else
+      {
+        game->drag_basket = 1;
+      }
+    }
+  }
+
+  if ((game->mouse_left_drag)&&(xpos < bask1->x+1.5)&&(bask1->active || (!bask1->active && game->drag_basket == 1))&&
+      (xpos > bask1->x-1.5)&&(ypos < bask1->y+0.5)&&(ypos > bask1->y - 0.5))
+  {
+    bask1->drag = true;
+    bask1->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
+  }
+
+  if ((game->mouse_left_drag)&&(xpos < bask2->x+1.5)&&(bask2->active || (!bask2->active && game->drag_basket == 2))&&
+      (xpos > bask2->x-1.5)&&(ypos < bask2->y+0.5)&&(ypos > bask2->y - 0.5))
+  {
+    bask2->drag = true;
+    bask2->x = xpos > 8.5 ? 8.5 : (xpos < -8.5 ? -8.5 : xpos);
+  }
+}
+
+/**************
+ * Simulation *
+ **************/
+
+bool validparams (const GameParams& params)
+{
+  return params.brick_falling_frequency >= min_falling_frequency &&
+         params.brick_falling_frequency <= max_falling_frequency &&
+         params.spawn_interval >= game_timestep && isfinite(params.spawn_interval) &&
+         params.hits_allowed >= 0;
+}
+
+void initgame (Game* game, uint64_t seed, int brick_capacity, const GameParams& params)
+{
+  *game = Game();
+  game->params = params;
+
+  game->seed = seed;
+  seedrandom(&game->random, seed);
+
+  initbrickpool(&game->bricks, brick_capacity);
+
+  Laser idle = Laser();
+  game->lasers.assign(20, idle);
+  game->new_laser_index = -1;
+
+  Mirror mirrors[] = { {0,0,30}, {0,5,150}, {5,-5,45} };
+  game->mirrors.assign(mirrors, mirrors + 3);
+
+  game->bask1.x = 5;
+  game->bask1.y = -9;
+  game->bask1.active = true;
+  game->bask2.x = -5;
+  game->bask2.y = -9;
+  game->bask2.active = true;
+
+  game->cannon.x = -9;
+  game->cannon.y = 0;
+  game->cannon.active = true;
+
+  game->brick_falling_frequency = params.brick_falling_frequency;
+  game->bx = 10;
+  game->bnx = -10;
+  game->by = 10;
+  game->bny = -10;
+
+  createbricks(game);
+  settimer(game, TIMER_SPAWN, params.spawn_interval);
+}
+
+/* A laser hits a brick in its way or moves on along its path */
+void steplaser (Game* game, Laser* laser)
+{
+  checkcollisionbtwlaserbrick(game, laser);
+  if (laser->active == true)
+  {
+    advancelaser(game, laser, laser_step);
+  }
+}
+
+/* Run every timer that has come due by sim_time */
+void runtimers (Game* game)
+{
+  while (!game->timers.empty() && game->timers.front().time <= game->sim_time)
+  {
+    GameTimer timer = game->timers.front();
+    pop_heap(game->timers.begin(), game->timers.end(), latertimer);
+    game->timers.pop_back();
+
+    switch (timer.kind) {
+      case TIMER_CANNON:
+        game->cannon.active = true;
+        break;
+
+      case TIMER_SPAWN:
+        createbricks(game);
+        settimer(game, TIMER_SPAWN, timer.time + game->params.spawn_interval);
+        break;
+
+      case TIMER_CATCH:
+        if (timer.generation == game->fall_generation)
+        {
+          catchbricks(game);
+        }
+        break;
+
+      case TIMER_LOST:
+        if (timer.generation == game->fall_generation)
+        {
+          losebricks(game);
+        }
+        break;
+    }
+  }
+}
+
+/* Advance the game by one fixed timestep of game_timestep seconds */
+void stepgame (Game* game)
+{
+  game->sim_time += game_timestep;
+  game->tick++;
+
+  updatedrag(game);
+
+  // Lasers advance laser_step units every tick along the path traced when they were fired
+  for (int j = 0 ; j < game->lasers.size(); j++)
+  {
+    Laser* laser = &game->lasers[j];
+    if (laser->active == true)
+    {
+      steplaser(game, laser);
+    }
+  }
+
+  checkcollisionbtwbaskets(game);
+
+  runtimers(game);
+
+  if (game->gameover)
+  {
+    game->events |= GAME_EVENT_GAMEOVER;
+  }
+}
+
+void rungame (Game* game, double seconds)
+{
+  for (double t = 0 ; t < seconds && !game->gameover ; t += game_timestep)
+  {
+    stepgame(game);
+  }
+}
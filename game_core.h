@@ -0,0 +1,266 @@
+#ifndef GAME_CORE_H
+#define GAME_CORE_H
+
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+/* Game rules and state with no GL, GLFW or libao dependency.
+   The frontend feeds input through the game* functions, calls stepgame once
+   per fixed timestep and reads the state back to render it */
+
+static const double game_timestep = 0.01; // seconds simulated by one stepgame
+
+/* Bricks only spawn at the integer columns -7..9 and fall straight down */
+static const int brick_column_min = -7;
+static const int brick_column_count = 17;
+static const float brick_spawn_y = 10;
+static const float brick_catch_y = -8; // where the basket rims check for bricks
+static const float brick_lost_y = -10.7; // where a missed brick leaves the screen
+
+/* Rules that balance tuning varies, fixed for the length of a game */
+struct GameParams {
+    float brick_falling_frequency; // starting seconds per 0.25 units of fall
+    double spawn_interval; // seconds between batches of bricks
+    int hits_allowed; // red or green bricks a player may shoot, one more ends the game
+    int catch_points; // brick caught in its own basket
+    int hit_points; // red or green brick shot
+    int black_points; // black brick shot
+};
+
+static const GameParams default_game_params = { 0.25, 5, 5, 20, -5, 50 };
+
+/* Fall rates the rules are played at, in seconds per 0.25 units. The keys
+   keep to 0.05..0.45 */
+static const float min_falling_frequency = 0.01f;
+static const float max_falling_frequency = 100;
+
+/* Whether the rules can run on these values. A spawn interval under one tick
+   would respawn without time moving on, so one step would never end.
+   readsnapshot and batchsim both hold their params to this */
+bool validparams (const GameParams& params);
+
+/* xorshift64* generator, one per game so runs replay from their seed */
+struct GameRandom {
+    uint64_t state; // never zero
+};
+
+void seedrandom (GameRandom* random, uint64_t seed);
+uint32_t nextrandom (GameRandom* random);
+int randomint (GameRandom* random, int n); // uniform in [0, n)
+
+/* Fixed-capacity brick storage with one array per field, indexed by slot.
+   Free slots sit on a free list and live slots are kept densely in "active",
+   so per-tick work only touches live bricks.
+
+   Bricks never store their height. Every brick falls at the same speed, so the
+   game keeps one fall distance for all of them and a brick only remembers how
+   far everything had fallen when it spawned */
+struct BrickPool {
+    std::vector<float> x; // left side, bricks are 0.7x0.7
+    std::vector<double> fall; // fall distance of the game when the brick spawned
+    std::vector<unsigned char> color; // 0 black, 1 red, 2 green
+    std::vector<uint64_t> alive; // one bit per slot
+
+    std::vector<int> freelist;
+    std::vector<int> active;
+    std::vector<int> slot; // position of each storage index in active, -1 when free
+    std::vector<int> columns[brick_column_count]; // live bricks per column, oldest (lowest) first
+
+    unsigned version; // bumped whenever a brick spawns or goes
+};
+
+/* Units a laser moves along its path every stepgame */
+static const float laser_step = 0.5;
+
+/* Most straight legs a laser path keeps, the beam dies at the end of the last one */
+static const int laser_max_legs = 16;
+
+struct Laser {
+    float x,y,inclination; // tail of the unit-length beam and its direction in degrees
+    bool active;
+
+    // Path traced through the mirrors when fired. Leg k starts at
+    // (pathx[k],pathy[k]) and runs pathlength[k] units at pathangle[k] degrees,
+    // the last leg ends on a wall
+    float pathx[laser_max_legs],pathy[laser_max_legs];
+    float pathangle[laser_max_legs],pathlength[laser_max_legs];
+    int legs;
+    int leg; // leg holding the tail
+    float along; // distance of the tail from the start of its leg
+    double legtime; // sim_time when the tail entered its leg
+};
+
+struct Mirror {
+    float x,y,angle; // centre and direction in degrees, mirrors are 2 units long
+};
+
+struct Basket {
+    float x,y;
+    bool active,drag;
+    int brickcount;
+};
+
+struct Cannon {
+    float x,y;
+    float rotation; // degrees, -90..90
+    bool active,drag;
+    double latest_fire_time;
+};
+
+/* Bits of Game::events, set by the rules and cleared by the frontend */
+enum GameEvent {
+    GAME_EVENT_SCORE = 1,      // score changed
+    GAME_EVENT_LASER = 2,      // a laser was fired
+    GAME_EVENT_REFLECTION = 4, // a laser bounced off a mirror
+    GAME_EVENT_GAMEOVER = 8,
+};
+
+enum GameKey {
+    GAME_KEY_FIRE,
+    GAME_KEY_TILT_UP,
+    GAME_KEY_TILT_DOWN,
+    GAME_KEY_CANNON_DOWN,
+    GAME_KEY_CANNON_UP,
+    GAME_KEY_FASTER,
+    GAME_KEY_SLOWER,
+    GAME_KEY_LEFT,
+    GAME_KEY_RIGHT,
+    GAME_KEY_UP,
+    GAME_KEY_DOWN,
+    GAME_KEY_RED_BASKET,   // held to move the red basket with left/right
+    GAME_KEY_GREEN_BASKET, // held to move the green basket with left/right
+};
+
+enum GameAction {
+    GAME_RELEASE,
+    GAME_PRESS,
+    GAME_REPEAT,
+};
+
+enum GameButton {
+    GAME_BUTTON_LEFT,
+    GAME_BUTTON_RIGHT,
+};
+
+/* A brick waiting for the fall distance to reach "fall" */
+struct BrickEvent {
+    int index;
+    double fall;
+};
+
+/* One call into the input API, stamped with the step it arrived before */
+enum GameInputType {
+    GAME_INPUT_KEY,
+    GAME_INPUT_BUTTON,
+    GAME_INPUT_POINTER,
+    GAME_INPUT_SCROLL,
+    GAME_INPUT_END, // tick at which the recording stopped
+};
+
+struct GameInput {
+    uint32_t tick;
+    uint8_t type; // GameInputType
+    uint8_t code; // GameKey or GameButton
+    uint8_t action; // GameAction
+    float a,b; // pointer x,y or scroll offset
+};
+
+/* Something the game has to do at a moment of sim_time */
+enum GameTimerKind {
+    TIMER_CANNON, // cannon ready to fire again
+    TIMER_SPAWN,  // next batch of bricks
+    TIMER_CATCH,  // front of catchqueue reaches the rims
+    TIMER_LOST,   // front of lostqueue leaves the screen
+};
+
+struct GameTimer {
+    double time;
+    unsigned order; // breaks ties in the order timers were set
+    int kind;
+    unsigned generation; // fall timers from before a speed change are stale
+};
+
+struct Game {
+    GameRandom random;
+    uint64_t seed;
+    GameParams params;
+
+    BrickPool bricks;
+    std::vector<Laser> lasers;
+    std::vector<Mirror> mirrors;
+    Basket bask1,bask2; // red and green
+    Cannon cannon;
+
+    int new_laser_index;
+    unsigned lasers_version; // bumped whenever a laser fires, turns or dies
+    double sim_time; // seconds of simulated game time
+    uint32_t tick; // stepgame calls so far
+    int totalbrickcount;
+    float brick_falling_frequency; // seconds per 0.25 units of fall
+
+    // The fall distance is fall_base at fall_base_time and grows linearly from
+    // there, a speed change just moves the base
+    double fall_base,fall_base_time;
+
+    // Bricks in the order they reach the rims and the bottom of the screen.
+    // All bricks fall alike, so both are ordered by spawn
+    std::deque<BrickEvent> catchqueue,lostqueue;
+
+    // Min-heap on time, stepgame only does the work of the timers that are due
+    std::vector<GameTimer> timers;
+    unsigned timer_order;
+    unsigned fall_generation;
+
+    float xpos,ypos; // pointer in world coordinates
+    float mxpos,mypos; // pointer when the right button went down
+    bool mouse_left_drag,mouse_right_drag;
+    int drag_basket;
+    bool ctrlflag,altflag;
+
+    float bx,bnx,by,bny; // visible part of the world, changed by zoom and pan
+
+    bool gameover;
+    int redbrickshit,greenbrickshit;
+    int score;
+
+    unsigned events; // GameEvent bits
+
+    // Every input call is appended here while recording is set
+    bool recording;
+    std::vector<GameInput> inputlog;
+};
+
+void initgame (Game* game, uint64_t seed, int brick_capacity = 256,
+               const GameParams& params = default_game_params);
+void stepgame (Game* game);
+void rungame (Game* game, double seconds); // fast-forward, stops early on game over
+
+/* The parts of stepgame, for game_batch to run across many games. A tick is
+   sim_time and tick moved on, updatedrag, steplaser for each active laser in
+   slot order, checkcollisionbtwbaskets and runtimers */
+void updatedrag (Game* game);
+void steplaser (Game* game, Laser* laser);
+void runtimers (Game* game);
+void checkcollisionbtwbaskets (Game* game);
+
+float brickspeed (const Game* game); // units per second
+double falldistance (const Game* game);
+double falltime (const Game* game, double fall); // sim_time at which falldistance reaches "fall"
+float brickheight (const Game* game, int index); // bottom of the brick in that slot
+bool brickalive (const BrickPool* bricks, int index);
+
+/* Segment tests behind the laser collisions. Bit i of checkintersection4 is
+   what checkintersection gives for edge i, exactly, simdcheck holds it to that */
+bool checkintersection (float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4);
+int checkintersection4 (float x1, float y1, float x2, float y2,
+                        const float* x3, const float* y3, const float* x4, const float* y4);
+
+void gamekey (Game* game, GameKey key, GameAction action);
+void gamebutton (Game* game, GameButton button, GameAction action);
+void gamepointer (Game* game, float x, float y);
+void gamescroll (Game* game, float yoffset);
+
+void applyinput (Game* game, const GameInput& input); // replay one recorded call
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "game_replay.h"
+#include "game_bytes.h"
+
+using namespace std;
+
+static const uint32_t input_log_version = 1;
+static const int input_record_size = 16;
+
+static void putinput (vector<unsigned char>& out, const GameInput& input)
+{
+  putle(out, input.tick, 4);
+  putle(out, input.type, 1);
+  putle(out, input.code, 1);
+  putle(out, input.action, 1);
+  putle(out, 0, 1);
+  putfloat(out, input.a);
+  putfloat(out, input.b);
+}
+
+bool saveinputlog (const Game* game, const char* filepath)
+{
+  vector<unsigned char> data;
+  data.insert(data.end(), "BSIL", "BSIL" + 4);
+  putle(data, input_log_version, 4);
+  putle(data, game->seed, 8);
+  putle(data, game->inputlog.size() + 1, 4);
+  for (size_t j = 0 ; j < game->inputlog.size() ; j++)
+  {
+    putinput(data, game->inputlog[j]);
+  }
+  GameInput end = { game->tick, GAME_INPUT_END, 0, 0, 0, 0 };
+  putinput(data, end);
+
+  FILE* file = fopen(filepath, "wb");
+  if (file == NULL)
+  {
+    return false;
+  }
+  bool written = fwrite(&data[0], 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && written;
+}
+
+bool loadinputlog (InputLog* log, const char* filepath)
+{
+  FILE* file = fopen(filepath, "rb");
+  if (file == NULL)
+  {
+    return false;
+  }
+  vector<unsigned char> data;
+  unsigned char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    data.insert(data.end(), buffer, buffer + n);
+  }
+  fclose(file);
+
+  ByteReader in = bytereader(data.empty() ? NULL : &data[0], data.size());
+  if (data.size() < 20 || memcmp(in.p, "BSIL", 4))
+  {
+    return false;
+  }
+  in.p += 4;
+  if (getle(&in, 4) != input_log_version)
+  {
+    return false;
+  }
+  log->seed = getle(&in, 8);
+  uint64_t count = getle(&in, 4);
+  if (count == 0 || data.size() != 20 + count * input_record_size)
+  {
+    return false;
+  }
+
+  log->inputs.resize(count);
+  for (size_t j = 0 ; j < count ; j++)
+  {
+    GameInput& input = log->inputs[j];
+    input.tick = getle(&in, 4);
+    input.type = getle(&in, 1);
+    input.code = getle(&in, 1);
+    input.action = getle(&in, 1);
+    getle(&in, 1);
+    input.a = getfloat(&in);
+    input.b = getfloat(&in);
+  }
+  return log->inputs[count - 1].type == GAME_INPUT_END;
+}
+
+bool replayinputs (Game* game, const InputLog& log, size_t* next)
+{
+  while (*next < log.inputs.size() && log.inputs[*next].tick <= game->tick)
+  {
+    if (log.inputs[*next].type == GAME_INPUT_END)
+    {
+      return false;
+    }
+    applyinput(game, log.inputs[*next]);
+    (*next)++;
+  }
+  return *next < log.inputs.size();
+}
+
+void runreplay (Game* game, const InputLog& log)
+{
+  initgame(game, log.seed);
+  size_t next = 0;
+  while (replayinputs(game, log, &next) && !game->gameover)
+  {
+    stepgame(game);
+  }
+}
@@ -0,0 +1,35 @@
+#ifndef GAME_REPLAY_H
+#define GAME_REPLAY_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "game_core.h"
+
+/* Input logs : the seed of a game and every call into its input API, stamped
+   with the tick it arrived before. The game is deterministic from its seed,
+   so feeding the log back reproduces the run exactly.
+
+   The file is little-endian : "BSIL", u32 version, u64 seed, u32 record
+   count, then 16 bytes per record (u32 tick, u8 type, u8 code, u8 action,
+   u8 padding, f32 a, f32 b). The last record is GAME_INPUT_END */
+
+struct InputLog {
+    uint64_t seed;
+    std::vector<GameInput> inputs; // ordered by tick, ends with GAME_INPUT_END
+};
+
+/* Write the log of a game that was recording, ended at its current tick */
+bool saveinputlog (const Game* game, const char* filepath);
+
+bool loadinputlog (InputLog* log, const char* filepath);
+
+/* Apply the inputs due before the next stepgame, "next" is the first record
+   not yet applied. Returns false once the log has ended */
+bool replayinputs (Game* game, const InputLog& log, size_t* next);
+
+/* Start the game over from the seed of the log and run it to the end of the
+   log or game over as fast as possible */
+void runreplay (Game* game, const InputLog& log);
+
+#endif
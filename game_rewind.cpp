@@ -0,0 +1,204 @@
+#include <string.h>
+
+#include "game_rewind.h"
+#include "game_snapshot.h"
+
+using namespace std;
+
+static void putvarint (vector<unsigned char>& out, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(value);
+}
+
+static bool getvarint (const unsigned char** p, const unsigned char* end, uint32_t* value)
+{
+  *value = 0;
+  for (int shift = 0 ; shift < 35 && *p < end ; shift += 7)
+  {
+    unsigned char byte = *(*p)++;
+    *value |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Delta of current from base : its size, then runs of (bytes kept from base,
+   bytes replaced, the replacing bytes). Equal runs shorter than 4 bytes are
+   cheaper inside the replaced bytes than as runs of their own */
+static void encodedelta (const vector<unsigned char>& base, const vector<unsigned char>& current, vector<unsigned char>& out)
+{
+  size_t n = current.size(), m = base.size();
+  out.clear();
+  putvarint(out, n);
+
+  size_t i = 0;
+  while (i < n)
+  {
+    size_t kept = i;
+    while (i < n && i < m && current[i] == base[i])
+    {
+      i++;
+    }
+    if (i == n)
+    {
+      break;
+    }
+
+    size_t changed = i;
+    while (i < n)
+    {
+      size_t same = i;
+      while (same < n && same < m && current[same] == base[same] && same - i < 4)
+      {
+        same++;
+      }
+      if (same - i == 4 || same == n)
+      {
+        break;
+      }
+      i = same + 1;
+    }
+
+    putvarint(out, changed - kept);
+    putvarint(out, i - changed);
+    out.insert(out.end(), current.begin() + changed, current.begin() + i);
+  }
+}
+
+static bool decodedelta (const vector<unsigned char>& base, const vector<unsigned char>& delta, vector<unsigned char>& out)
+{
+  const unsigned char* p = delta.empty() ? NULL : &delta[0];
+  const unsigned char* end = p + delta.size();
+  uint32_t n;
+  if (!getvarint(&p, end, &n))
+  {
+    return false;
+  }
+  out.assign(base.begin(), base.begin() + min((size_t)n, base.size()));
+  out.resize(n);
+
+  size_t position = 0;
+  while (p < end)
+  {
+    uint32_t kept, changed;
+    if (!getvarint(&p, end, &kept) || !getvarint(&p, end, &changed) ||
+        position + kept + changed > n || (size_t)(end - p) < changed)
+    {
+      return false;
+    }
+    position += kept;
+    memcpy(&out[position], p, changed);
+    position += changed;
+    p += changed;
+  }
+  return true;
+}
+
+void initrewind (RewindBuffer* rewind, int capacity, int keyframe_interval)
+{
+  rewind->frames.clear();
+  rewind->capacity = capacity;
+  rewind->keyframe_interval = keyframe_interval;
+  rewind->since_keyframe = keyframe_interval;
+  rewind->keyframe.clear();
+}
+
+void recordrewind (RewindBuffer* rewind, const Game* game)
+{
+  if (rewind->capacity <= 0)
+  {
+    return;
+  }
+
+  RewindFrame frame;
+  frame.tick = game->tick;
+  frame.keyframe = rewind->since_keyframe >= rewind->keyframe_interval;
+  if (frame.keyframe)
+  {
+    writesnapshot(game, &rewind->keyframe);
+    frame.data = rewind->keyframe;
+    rewind->since_keyframe = 0;
+  }
+  else
+  {
+    writesnapshot(game, &rewind->snapshot);
+    encodedelta(rewind->keyframe, rewind->snapshot, frame.data);
+  }
+  rewind->since_keyframe++;
+  rewind->frames.push_back(frame);
+
+  // Deltas are useless without their keyframe, so drop whole groups
+  if ((int)rewind->frames.size() > rewind->capacity)
+  {
+    do
+    {
+      rewind->frames.pop_front();
+    }
+    while (!rewind->frames.empty() && !rewind->frames.front().keyframe);
+  }
+}
+
+bool rewindgame (RewindBuffer* rewind, Game* game, int ticks)
+{
+  if (rewind->frames.empty())
+  {
+    return false;
+  }
+  int target = max(0, (int)rewind->frames.size() - 1 - ticks);
+  int key = target;
+  while (!rewind->frames[key].keyframe)
+  {
+    key--;
+  }
+
+  const RewindFrame& frame = rewind->frames[target];
+  const vector<unsigned char>* data = &frame.data;
+  if (!frame.keyframe)
+  {
+    if (!decodedelta(rewind->frames[key].data, frame.data, rewind->snapshot))
+    {
+      return false;
+    }
+    data = &rewind->snapshot;
+  }
+
+  // The input log is not in the snapshot, keep the part that led here.
+  // Inputs stamped with this tick came after the frame was recorded
+  bool recording = game->recording;
+  vector<GameInput> inputlog;
+  inputlog.swap(game->inputlog);
+  if (!readsnapshot(game, &(*data)[0], data->size()))
+  {
+    inputlog.swap(game->inputlog);
+    return false;
+  }
+  while (!inputlog.empty() && inputlog.back().tick >= game->tick)
+  {
+    inputlog.pop_back();
+  }
+  game->recording = recording;
+  game->inputlog.swap(inputlog);
+
+  // Carry on as if this frame was the newest, starting a fresh keyframe
+  rewind->frames.resize(target + 1);
+  rewind->since_keyframe = rewind->keyframe_interval;
+  return true;
+}
+
+size_t rewindbytes (const RewindBuffer* rewind)
+{
+  size_t bytes = 0;
+  for (size_t j = 0 ; j < rewind->frames.size() ; j++)
+  {
+    bytes += rewind->frames[j].data.size();
+  }
+  return bytes;
+}
@@ -0,0 +1,43 @@
+#ifndef GAME_REWIND_H
+#define GAME_REWIND_H
+
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+#include "game_core.h"
+
+/* The last few seconds of a game, one snapshot per tick, to step back through.
+   Every keyframe_interval ticks a full snapshot is kept, the ticks in between
+   only keep the bytes where they differ from that keyframe, so a frame costs
+   a few hundred bytes while bricks and lasers stand still in the snapshot */
+
+struct RewindFrame {
+    uint32_t tick;
+    bool keyframe;
+    std::vector<unsigned char> data; // snapshot, or its delta from the keyframe before it
+};
+
+struct RewindBuffer {
+    std::deque<RewindFrame> frames; // oldest first, always starts on a keyframe
+    int capacity; // frames kept, older keyframe groups are dropped whole
+    int keyframe_interval;
+    int since_keyframe; // frames recorded since the last keyframe
+    std::vector<unsigned char> keyframe; // snapshot of the last keyframe
+    std::vector<unsigned char> snapshot; // scratch
+};
+
+void initrewind (RewindBuffer* rewind, int capacity, int keyframe_interval = 100);
+
+/* Keep the state of the game after a stepgame */
+void recordrewind (RewindBuffer* rewind, const Game* game);
+
+/* Put the game back to the frame "ticks" frames before the newest one and
+   forget the frames after it, so the game carries on from there exactly as it
+   did the first time. A recording keeps its input log up to that tick.
+   Steps back as far as the buffer goes, returns false when it is empty */
+bool rewindgame (RewindBuffer* rewind, Game* game, int ticks);
+
+size_t rewindbytes (const RewindBuffer* rewind); // memory held by the frames
+
+#endif
@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "game_snapshot.h"
+#include "game_bytes.h"
+
+using namespace std;
+
+static const uint32_t snapshot_version = 3; // 2 added the GameParams, 3 dropped the events
+
+static const uint32_t snapshot_max_bricks = 1 << 16;
+static const uint32_t snapshot_max_lasers = 1024;
+
+static void putints (vector<unsigned char>& out, const vector<int>& values)
+{
+  putle(out, values.size(), 4);
+  for (size_t j = 0 ; j < values.size() ; j++)
+  {
+    putle(out, (uint32_t)values[j], 4);
+  }
+}
+
+static void getints (ByteReader* in, vector<int>& values, int capacity)
+{
+  uint32_t count = getle(in, 4);
+  if (count > (uint32_t)capacity)
+  {
+    in->ok = false;
+    return;
+  }
+  values.resize(count);
+  for (uint32_t j = 0 ; j < count ; j++)
+  {
+    values[j] = (int32_t)getle(in, 4);
+    if (values[j] < 0 || values[j] >= capacity)
+    {
+      in->ok = false;
+    }
+  }
+}
+
+static void putqueue (vector<unsigned char>& out, const deque<BrickEvent>& queue)
+{
+  putle(out, queue.size(), 4);
+  for (size_t j = 0 ; j < queue.size() ; j++)
+  {
+    putle(out, queue[j].index, 4);
+    putdouble(out, queue[j].fall);
+  }
+}
+
+static void getqueue (ByteReader* in, deque<BrickEvent>& queue, int capacity)
+{
+  uint32_t count = getle(in, 4);
+  if (count > (uint32_t)capacity)
+  {
+    in->ok = false;
+    return;
+  }
+  queue.clear();
+  for (uint32_t j = 0 ; j < count ; j++)
+  {
+    BrickEvent event;
+    event.index = (int32_t)getle(in, 4);
+    event.fall = getdouble(in);
+    queue.push_back(event);
+  }
+}
+
+void writesnapshot (const Game* game, vector<unsigned char>* out)
+{
+  vector<unsigned char>& data = *out;
+  data.clear();
+  data.insert(data.end(), "BSGS", "BSGS" + 4);
+  putle(data, snapshot_version, 4);
+
+  putle(data, game->seed, 8);
+  putle(data, game->random.state, 8);
+
+  putfloat(data, game->params.brick_falling_frequency);
+  putdouble(data, game->params.spawn_interval);
+  putle(data, game->params.hits_allowed, 4);
+  putle(data, game->params.catch_points, 4);
+  putle(data, game->params.hit_points, 4);
+  putle(data, game->params.black_points, 4);
+
+  // Live bricks in active order, then the free list and the columns, so
+  // every slot comes back to the same index
+  const BrickPool& bricks = game->bricks;
+  putle(data, bricks.x.size(), 4);
+  putle(data, bricks.version, 4);
+  putle(data, bricks.active.size(), 4);
+  for (size_t j = 0 ; j < bricks.active.size() ; j++)
+  {
+    int index = bricks.active[j];
+    putle(data, index, 4);
+    putfloat(data, bricks.x[index]);
+    putdouble(data, bricks.fall[index]);
+    putle(data, bricks.color[index], 1);
+  }
+  putints(data, bricks.freelist);
+  for (int c = 0 ; c < brick_column_count ; c++)
+  {
+    putints(data, bricks.columns[c]);
+  }
+
+  putle(data, game->lasers.size(), 4);
+  for (size_t j = 0 ; j < game->lasers.size() ; j++)
+  {
+    const Laser& laser = game->lasers[j];
+    putfloat(data, laser.x);
+    putfloat(data, laser.y);
+    putfloat(data, laser.inclination);
+    putle(data, laser.active, 1);
+    putle(data, laser.legs, 4);
+    for (int k = 0 ; k < laser.legs ; k++)
+    {
+      putfloat(data, laser.pathx[k]);
+      putfloat(data, laser.pathy[k]);
+      putfloat(data, laser.pathangle[k]);
+      putfloat(data, laser.pathlength[k]);
+    }
+    putle(data, laser.leg, 4);
+    putfloat(data, laser.along);
+    putdouble(data, laser.legtime);
+  }
+
+  putle(data, game->mirrors.size(), 4);
+  for (size_t j = 0 ; j < game->mirrors.size() ; j++)
+  {
+    putfloat(data, game->mirrors[j].x);
+    putfloat(data, game->mirrors[j].y);
+    putfloat(data, game->mirrors[j].angle);
+  }
+
+  const Basket* baskets[2] = { &game->bask1, &game->bask2 };
+  for (int b = 0 ; b < 2 ; b++)
+  {
+    putfloat(data, baskets[b]->x);
+    putfloat(data, baskets[b]->y);
+    putle(data, baskets[b]->active, 1);
+    putle(data, baskets[b]->drag, 1);
+    putle(data, baskets[b]->brickcount, 4);
+  }
+
+  putfloat(data, game->cannon.x);
+  putfloat(data, game->cannon.y);
+  putfloat(data, game->cannon.rotation);
+  putle(data, game->cannon.active, 1);
+  putle(data, game->cannon.drag, 1);
+  putdouble(data, game->cannon.latest_fire_time);
+
+  putle(data, game->new_laser_index, 4);
+  putle(data, game->lasers_version, 4);
+  putdouble(data, game->sim_time);
+  putle(data, game->tick, 4);
+  putle(data, game->totalbrickcount, 4);
+  putfloat(data, game->brick_falling_frequency);
+  putdouble(data, game->fall_base);
+  putdouble(data, game->fall_base_time);
+
+  putqueue(data, game->catchqueue);
+  putqueue(data, game->lostqueue);
+
+  // The heap is written as it is laid out, which is still a heap when read back
+  putle(data, game->timers.size(), 4);
+  for (size_t j = 0 ; j < game->timers.size() ; j++)
+  {
+    putdouble(data, game->timers[j].time);
+    putle(data, game->timers[j].order, 4);
+    putle(data, game->timers[j].kind, 4);
+    putle(data, game->timers[j].generation, 4);
+  }
+  putle(data, game->timer_order, 4);
+  putle(data, game->fall_generation, 4);
+
+  putfloat(data, game->xpos);
+  putfloat(data, game->ypos);
+  putfloat(data, game->mxpos);
+  putfloat(data, game->mypos);
+  putle(data, game->mouse_left_drag, 1);
+  putle(data, game->mouse_right_drag, 1);
+  putle(data, game->drag_basket, 4);
+  putle(data, game->ctrlflag, 1);
+  putle(data, game->altflag, 1);
+
+  putfloat(data, game->bx);
+  putfloat(data, game->bnx);
+  putfloat(data, game->by);
+  putfloat(data, game->bny);
+
+  putle(data, game->gameover, 1);
+  putle(data, game->redbrickshit, 4);
+  putle(data, game->greenbrickshit, 4);
+  putle(data, game->score, 4);
+  // events are not saved, they are for the frontend to handle once
+}
+
+bool readsnapshot (Game* target, const unsigned char* data, size_t size)
+{
+  ByteReader in = bytereader(data, size);
+  if (size < 8 || memcmp(data, "BSGS", 4))
+  {
+    return false;
+  }
+  in.p += 4;
+  uint32_t version = getle(&in, 4);
+  if (version < 1 || version > snapshot_version)
+  {
+    return false;
+  }
+
+  Game loaded = Game();
+  Game* game = &loaded;
+
+  game->seed = getle(&in, 8);
+  game->random.state = getle(&in, 8);
+
+  game->params = default_game_params;
+  if (version >= 2)
+  {
+    game->params.brick_falling_frequency = getfloat(&in);
+    game->params.spawn_interval = getdouble(&in);
+    game->params.hits_allowed = (int32_t)getle(&in, 4);
+    game->params.catch_points = (int32_t)getle(&in, 4);
+    game->params.hit_points = (int32_t)getle(&in, 4);
+    game->params.black_points = (int32_t)getle(&in, 4);
+  }
+  if (!validparams(game->params))
+  {
+    return false;
+  }
+
+  BrickPool& bricks = game->bricks;
+  uint32_t capacity = getle(&in, 4);
+  if (capacity > snapshot_max_bricks)
+  {
+    return false;
+  }
+  bricks.x.assign(capacity, 0);
+  bricks.fall.assign(capacity, 0);
+  bricks.color.assign(capacity, 0);
+  bricks.alive.assign((capacity + 63) / 64, 0);
+  bricks.slot.assign(capacity, -1);
+  bricks.version = getle(&in, 4);
+  uint32_t live = getle(&in, 4);
+  if (live > capacity)
+  {
+    return false;
+  }
+  bricks.active.reserve(capacity);
+  for (uint32_t j = 0 ; j < live && in.ok ; j++)
+  {
+    uint32_t index = getle(&in, 4);
+    if (index >= capacity || bricks.slot[index] >= 0)
+    {
+      return false;
+    }
+    bricks.slot[index] = j;
+    bricks.active.push_back(index);
+    bricks.x[index] = getfloat(&in);
+    bricks.fall[index] = getdouble(&in);
+    bricks.color[index] = getle(&in, 1);
+    bricks.alive[index / 64] |= 1ULL << (index % 64);
+
+    // Bricks sit on the integer columns and come in three colours
+    float x = bricks.x[index];
+    if (bricks.color[index] >= 3 || !(x >= brick_column_min && x < brick_column_min + brick_column_count) ||
+        x != floorf(x) || !isfinite(bricks.fall[index]))
+    {
+      return false;
+    }
+  }
+
+  // Every slot is either live or free, once
+  getints(&in, bricks.freelist, capacity);
+  vector<bool> seen(capacity, false);
+  for (size_t j = 0 ; j < bricks.freelist.size() ; j++)
+  {
+    int index = bricks.freelist[j];
+    if (!in.ok || bricks.slot[index] >= 0 || seen[index])
+    {
+      return false;
+    }
+    seen[index] = true;
+  }
+
+  // And every live brick is in its own column, once
+  size_t columned = 0;
+  seen.assign(capacity, false);
+  for (int c = 0 ; c < brick_column_count ; c++)
+  {
+    getints(&in, bricks.columns[c], capacity);
+    for (size_t j = 0 ; j < bricks.columns[c].size() && in.ok ; j++)
+    {
+      int index = bricks.columns[c][j];
+      if (bricks.slot[index] < 0 || seen[index] || (int)bricks.x[index] - brick_column_min != c)
+      {
+        return false;
+      }
+      seen[index] = true;
+    }
+    columned += bricks.columns[c].size();
+  }
+  if (columned != live)
+  {
+    return false;
+  }
+
+  uint32_t lasers = getle(&in, 4);
+  if (lasers == 0 || lasers > snapshot_max_lasers)
+  {
+    return false;
+  }
+  game->lasers.assign(lasers, Laser());
+  for (uint32_t j = 0 ; j < lasers && in.ok ; j++)
+  {
+    Laser& laser = game->lasers[j];
+    laser.x = getfloat(&in);
+    laser.y = getfloat(&in);
+    laser.inclination = getfloat(&in);
+    laser.active = getle(&in, 1);
+    laser.legs = (int32_t)getle(&in, 4);
+    if (laser.legs < 0 || laser.legs > laser_max_legs)
+    {
+      return false;
+    }
+    for (int k = 0 ; k < laser.legs ; k++)
+    {
+      laser.pathx[k] = getfloat(&in);
+      laser.pathy[k] = getfloat(&in);
+      laser.pathangle[k] = getfloat(&in);
+      laser.pathlength[k] = getfloat(&in);
+    }
+    laser.leg = (int32_t)getle(&in, 4);
+    laser.along = getfloat(&in);
+    laser.legtime = getdouble(&in);
+    // An idle laser has no legs and sits on leg 0
+    if (laser.leg < 0 || laser.leg >= max(laser.legs, 1) || (laser.active && laser.legs == 0))
+    {
+      return false;
+    }
+  }
+
+  uint32_t mirrors = getle(&in, 4);
+  if (mirrors > 1024)
+  {
+    return false;
+  }
+  game->mirrors.resize(mirrors);
+  for (uint32_t j = 0 ; j < mirrors ; j++)
+  {
+    game->mirrors[j].x = getfloat(&in);
+    game->mirrors[j].y = getfloat(&in);
+    game->mirrors[j].angle = getfloat(&in);
+  }
+
+  Basket* baskets[2] = { &game->bask1, &game->bask2 };
+  for (int b = 0 ; b < 2 ; b++)
+  {
+    baskets[b]->x = getfloat(&in);
+    baskets[b]->y = getfloat(&in);
+    baskets[b]->active = getle(&in, 1);
+    baskets[b]->drag = getle(&in, 1);
+    baskets[b]->brickcount = (int32_t)getle(&in, 4);
+  }
+
+  game->cannon.x = getfloat(&in);
+  game->cannon.y = getfloat(&in);
+  game->cannon.rotation = getfloat(&in);
+  game->cannon.active = getle(&in, 1);
+  game->cannon.drag = getle(&in, 1);
+  game->cannon.latest_fire_time = getdouble(&in);
+
+  game->new_laser_index = (int32_t)getle(&in, 4);
+  game->lasers_version = getle(&in, 4);
+  game->sim_time = getdouble(&in);
+  game->tick = getle(&in, 4);
+  game->totalbrickcount = (int32_t)getle(&in, 4);
+  game->brick_falling_frequency = getfloat(&in);
+  game->fall_base = getdouble(&in);
+  game->fall_base_time = getdouble(&in);
+  // Infinite times would keep every timer due
+  if (game->new_laser_index < -1 || game->new_laser_index >= (int)lasers ||
+      !(game->brick_falling_frequency >= min_falling_frequency && game->brick_falling_frequency <= max_falling_frequency) ||
+      !isfinite(game->sim_time) || !isfinite(game->fall_base) || !isfinite(game->fall_base_time))
+  {
+    return false;
+  }
+
+  getqueue(&in, game->catchqueue, capacity);
+  getqueue(&in, game->lostqueue, capacity);
+
+  uint32_t timers = getle(&in, 4);
+  if (timers > 1024)
+  {
+    return false;
+  }
+  game->timers.resize(timers);
+  for (uint32_t j = 0 ; j < timers ; j++)
+  {
+    game->timers[j].time = getdouble(&in);
+    game->timers[j].order = getle(&in, 4);
+    game->timers[j].kind = (int32_t)getle(&in, 4);
+    game->timers[j].generation = getle(&in, 4);
+    // Each step runs the timers it reaches, so none is left far behind the
+    // clock; one that was would respawn bricks for every interval it missed
+    if (game->timers[j].kind < TIMER_CANNON || game->timers[j].kind > TIMER_LOST ||
+        !isfinite(game->timers[j].time) || game->timers[j].time < game->sim_time - game_timestep)
+    {
+      return false;
+    }
+  }
+  game->timer_order = getle(&in, 4);
+  game->fall_generation = getle(&in, 4);
+
+  game->xpos = getfloat(&in);
+  game->ypos = getfloat(&in);
+  game->mxpos = getfloat(&in);
+  game->mypos = getfloat(&in);
+  game->mouse_left_drag = getle(&in, 1);
+  game->mouse_right_drag = getle(&in, 1);
+  game->drag_basket = (int32_t)getle(&in, 4);
+  game->ctrlflag = getle(&in, 1);
+  game->altflag = getle(&in, 1);
+
+  game->bx = getfloat(&in);
+  game->bnx = getfloat(&in);
+  game->by = getfloat(&in);
+  game->bny = getfloat(&in);
+
+  game->gameover = getle(&in, 1);
+  game->redbrickshit = (int32_t)getle(&in, 4);
+  game->greenbrickshit = (int32_t)getle(&in, 4);
+  game->score = (int32_t)getle(&in, 4);
+  if (version < 3)
+  {
+    getle(&in, 4);
+  }
+
+  if (!in.ok || in.p != in.end || bricks.active.size() + bricks.freelist.size() != capacity)
+  {
+    return false;
+  }
+
+  // Queued bricks may have been shot since, but they are slots of the pool
+  for (size_t j = 0 ; j < game->catchqueue.size() ; j++)
+  {
+    if (game->catchqueue[j].index < 0 || game->catchqueue[j].index >= (int)capacity)
+    {
+      return false;
+    }
+  }
+  for (size_t j = 0 ; j < game->lostqueue.size() ; j++)
+  {
+    if (game->lostqueue[j].index < 0 || game->lostqueue[j].index >= (int)capacity)
+    {
+      return false;
+    }
+  }
+
+  *target = loaded;
+  return true;
+}
+
+bool savesnapshot (const Game* game, const char* filepath)
+{
+  vector<unsigned char> data;
+  writesnapshot(game, &data);
+
+  FILE* file = fopen(filepath, "wb");
+  if (file == NULL)
+  {
+    return false;
+  }
+  bool written = fwrite(&data[0], 1, data.size(), file) == data.size();
+  return fclose(file) == 0 && written;
+}
+
+bool loadsnapshot (Game* game, const char* filepath)
+{
+  int fd = open(filepath, O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    return false;
+  }
+  bool loaded = readsnapshot(game, (const unsigned char*)mapping, info.st_size);
+  munmap(mapping, info.st_size);
+  return loaded;
+}
@@ -0,0 +1,34 @@
+#ifndef GAME_SNAPSHOT_H
+#define GAME_SNAPSHOT_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "game_core.h"
+
+/* Snapshots : the whole state of a game, random generator, queues and timers
+   included, so a restored game carries on exactly as the saved one would.
+   The input log of a recording game and the events not yet handled are not
+   part of it, so a restore never replays sounds or score messages.
+
+   The format is little-endian and versioned, "BSGS" then a u32 version,
+   followed by the fields in the order writesnapshot puts them. Only live
+   bricks are written, so a snapshot is a few kilobytes */
+
+void writesnapshot (const Game* game, std::vector<unsigned char>* out);
+
+/* Replace *game with the snapshot in data. Returns false, leaving *game
+   untouched, when data is not a complete snapshot of this or an earlier
+   version, or holds state the rules could index out of range with : colours,
+   columns, laser legs, the laser ring, the free list, the columns and the
+   timer kinds are all checked. So is state they could not step through in
+   finite time : params that fail validparams, a fall rate out of range,
+   non-finite times, or a timer left behind the clock */
+bool readsnapshot (Game* game, const unsigned char* data, size_t size);
+
+bool savesnapshot (const Game* game, const char* filepath);
+
+/* Read a snapshot file through a read-only mapping of it */
+bool loadsnapshot (Game* game, const char* filepath);
+
+#endif
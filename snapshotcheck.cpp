@@ -0,0 +1,159 @@
+#include <iostream>
+#include <math.h>
+
+#include "game_core.h"
+#include "game_snapshot.h"
+
+using namespace std;
+
+/* readsnapshot has to load back every snapshot a game can produce and carry
+   on identically, and refuse anything the rules could not step through :
+   state they would index out of range with, or values that would keep a
+   step from ever ending. Plays a game with a simple bot, round trips it
+   every 100 ticks, then checks that corrupted copies of it are rejected and
+   that random damage never gets through to a step that hangs or crashes */
+
+static const int flips = 20000;
+
+static void bot (Game* game, int i)
+{
+  if (i % 37 == 0)
+  {
+    gamepointer(game, (i % 200) / 10.0f - 10, -7);
+  }
+  if (i % 50 == 0)
+  {
+    gamekey(game, GAME_KEY_FIRE, GAME_PRESS);
+  }
+  if (i % 90 == 0)
+  {
+    gamekey(game, i % 180 ? GAME_KEY_TILT_UP : GAME_KEY_TILT_DOWN, GAME_PRESS);
+  }
+  if (i % 700 == 0)
+  {
+    gamekey(game, i % 1400 ? GAME_KEY_SLOWER : GAME_KEY_FASTER, GAME_PRESS);
+  }
+}
+
+struct Corruption {
+  const char* name;
+  void (*apply) (Game* game);
+};
+
+static const Corruption corruptions[] = {
+  { "brick colour", [] (Game* g) { g->bricks.color[g->bricks.active[0]] = 200; } },
+  { "brick column", [] (Game* g) { g->bricks.x[g->bricks.active[0]] = 40; } },
+  { "brick fall", [] (Game* g) { g->bricks.fall[g->bricks.active[0]] = NAN; } },
+  { "live brick on the free list", [] (Game* g) { g->bricks.freelist.push_back(g->bricks.active[0]); } },
+  { "brick in two columns", [] (Game* g) {
+      int index = g->bricks.active[0];
+      g->bricks.columns[((int)g->bricks.x[index] - brick_column_min + 1) % brick_column_count].push_back(index); } },
+  { "laser leg", [] (Game* g) { g->lasers[0].leg = 999; } },
+  { "laser ring index", [] (Game* g) { g->new_laser_index = -7; } },
+  { "timer kind", [] (Game* g) { g->timers[0].kind = 9; } },
+  { "spawn interval 0", [] (Game* g) { g->params.spawn_interval = 0; } },
+  { "spawn interval 1e-300", [] (Game* g) { g->params.spawn_interval = 1e-300; } },
+  { "spawn interval infinite", [] (Game* g) { g->params.spawn_interval = INFINITY; } },
+  { "starting fall rate 1e-30", [] (Game* g) { g->params.brick_falling_frequency = 1e-30f; } },
+  { "starting fall rate 1e30", [] (Game* g) { g->params.brick_falling_frequency = 1e30f; } },
+  { "fall rate NaN", [] (Game* g) { g->brick_falling_frequency = NAN; } },
+  { "fall rate 1e-30", [] (Game* g) { g->brick_falling_frequency = 1e-30f; } },
+  { "negative hits allowed", [] (Game* g) { g->params.hits_allowed = -1; } },
+  { "sim_time infinite", [] (Game* g) { g->sim_time = INFINITY; } },
+  { "fall_base NaN", [] (Game* g) { g->fall_base = NAN; } },
+  { "fall_base_time infinite", [] (Game* g) { g->fall_base_time = -INFINITY; } },
+  { "timer time NaN", [] (Game* g) { g->timers[0].time = NAN; } },
+  { "timer far behind the clock", [] (Game* g) { g->timers[0].time = g->sim_time - 1e6; } },
+};
+
+int main ()
+{
+  int failures = 0;
+
+  Game game;
+  initgame(&game, 7);
+  vector<unsigned char> a, b;
+  Game restored;
+  int i = 0;
+  for ( ; i < 3000 && !game.gameover ; i++)
+  {
+    bot(&game, i);
+    stepgame(&game);
+    if (i % 100 == 0)
+    {
+      writesnapshot(&game, &a);
+      if (!readsnapshot(&restored, &a[0], a.size()))
+      {
+        cout << "snapshot at tick " << game.tick << " rejected" << endl;
+        failures++;
+        continue;
+      }
+      writesnapshot(&restored, &b);
+      failures += a != b;
+    }
+  }
+
+  // A restored game carries on as the saved one does
+  writesnapshot(&game, &a);
+  readsnapshot(&restored, &a[0], a.size());
+  for (int j = i ; j < i + 20000 ; j++)
+  {
+    bot(&game, j);
+    bot(&restored, j);
+    stepgame(&game);
+    stepgame(&restored);
+  }
+  writesnapshot(&game, &a);
+  writesnapshot(&restored, &b);
+  if (a != b)
+  {
+    cout << "restored game played differently" << endl;
+    failures++;
+  }
+
+  Game saved = game;
+  writesnapshot(&saved, &a);
+  for (size_t j = 0 ; j < sizeof(corruptions) / sizeof(corruptions[0]) ; j++)
+  {
+    Game corrupt = saved;
+    corruptions[j].apply(&corrupt);
+    writesnapshot(&corrupt, &b);
+    if (readsnapshot(&restored, &b[0], b.size()))
+    {
+      cout << corruptions[j].name << " accepted" << endl;
+      failures++;
+    }
+  }
+
+  for (size_t size = 0 ; size < a.size() ; size++)
+  {
+    if (readsnapshot(&restored, &a[0], size))
+    {
+      cout << "snapshot cut to " << size << " bytes accepted" << endl;
+      failures++;
+    }
+  }
+
+  // Whatever random damage gets through must still step
+  GameRandom random;
+  seedrandom(&random, 1);
+  int accepted = 0;
+  for (int j = 0 ; j < flips ; j++)
+  {
+    b = a;
+    b[8 + randomint(&random, b.size() - 8)] ^= 1 << randomint(&random, 8);
+    if (readsnapshot(&restored, &b[0], b.size()))
+    {
+      accepted++;
+      for (int t = 0 ; t < 100 && !restored.gameover ; t++)
+      {
+        stepgame(&restored);
+      }
+    }
+  }
+
+  cout << sizeof(corruptions) / sizeof(corruptions[0]) << " corruptions, " << a.size() << " truncations, "
+       << flips << " bit flips (" << accepted << " loaded and stepped), " << failures << " failures" << endl;
+
+  return failures == 0 ? 0 : 1;
+}